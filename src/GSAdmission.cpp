@@ -0,0 +1,166 @@
+//
+// GSAdmission.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSAdmission.h"
+
+#include "Poco/NumberParser.h"
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+namespace
+{
+	double deviceWeight(const std::string& device)
+	{
+		if (device == "pxlmono" || device == "pngmono")
+			return 1;
+		if (device == "pnggray" || device == "jpeggray" || device == "png16")
+			return 2;
+		if (device == "png48" || device == "jpegcmyk")
+			return 6;
+		// 24 bit color: pxlcolor, pcl3, pclm, png16m, pngalpha, jpeg
+		return 3;
+	}
+
+	double resolutionFactor(const std::vector<std::string>& gsArgs)
+	{
+		// -r300, -r600x300: cost grows with the pixel count
+		for (const auto& a : gsArgs)
+		{
+			if (a.size() < 3 || a.compare(0, 2, "-r") != 0)
+				continue;
+			const std::string value = a.substr(2);
+			const std::string::size_type x = value.find('x');
+			double xres = 0, yres = 0;
+			if (!NumberParser::tryParseFloat(value.substr(0, x), xres))
+				continue;
+			if (x == std::string::npos || !NumberParser::tryParseFloat(value.substr(x + 1), yres))
+				yres = xres;
+			if (xres > 0 && yres > 0)
+				return (xres / 300) * (yres / 300);
+		}
+		return 1;
+	}
+
+	// a letter page at 300 dpi in 1 bit is about a megabyte
+	const double LETTER_AREA = 612.0 * 792.0;
+	// decoding and scaling a megapixel of image data, in the same units
+	const double IMAGE_MEGAPIXEL_COST = 0.25;
+}
+
+
+GSAdmission::GSAdmission(LayeredConfiguration& config, Logger& logger) :
+	_maxJobs(static_cast<std::size_t>(config.getInt("admission.maxJobs", 0))),
+	_maxBytes(static_cast<Poco::UInt64>(config.getInt64("admission.maxBytes", 0)) * 1024 * 1024),
+	_maxCost(config.getDouble("admission.maxCost", 0)),
+	_retryAfter(config.getInt("admission.retryAfter", 10)),
+	_logger(logger)
+{
+	if (_maxJobs || _maxBytes || _maxCost > 0)
+		_logger.information("Admission limits: %z job(s), %Lu byte(s), cost %.0f (0: unlimited).", _maxJobs, _maxBytes, _maxCost);
+}
+
+GSAdmission::~GSAdmission()
+{
+}
+
+bool GSAdmission::admit(Job& job, Poco::UInt64 bytes, bool force)
+{
+	const double cost = estimate(job.device, job.gsArgs, bytes);
+
+	FastMutex::ScopedLock lock(_mutex);
+	if (_jobs > 0 && !force)
+	{
+		if ((_maxJobs && _jobs + 1 > _maxJobs) ||
+			(_maxBytes && _bytes + bytes > _maxBytes) ||
+			(_maxCost > 0 && _cost + cost > _maxCost))
+		{
+			++_rejected;
+			_logger.warning("Backlog full (%z job(s), %Lu byte(s), cost %.1f), rejecting %s",
+				_jobs, _bytes, _cost, job.outputPath);
+			return false;
+		}
+	}
+	++_jobs;
+	_bytes += bytes;
+	_cost += cost;
+	job.admittedBytes = bytes;
+	job.cost = cost;
+	job.admitted = true;
+	return true;
+}
+
+void GSAdmission::release(Job& job)
+{
+	if (!job.admitted.exchange(false))
+		return;
+
+	FastMutex::ScopedLock lock(_mutex);
+	--_jobs;
+	_bytes -= job.admittedBytes;
+	_cost -= job.cost;
+	if (_jobs == 0)
+		_cost = 0;	// no drift from floating point rounding
+}
+
+void GSAdmission::reestimate(Job& job, double cost)
+{
+	FastMutex::ScopedLock lock(_mutex);
+	if (!job.admitted)
+		return;
+	_cost += cost - job.cost;
+	job.cost = cost;
+}
+
+double GSAdmission::estimate(const std::string& device, const std::vector<std::string>& gsArgs, Poco::UInt64 bytes)
+{
+	return static_cast<double>(bytes) / (1024 * 1024) * deviceWeight(device) * resolutionFactor(gsArgs);
+}
+
+double GSAdmission::estimate(const std::string& device, const std::vector<std::string>& gsArgs, Poco::UInt64 bytes,
+	const GSPreflightResult& preflight)
+{
+	if (preflight.pages <= 0)
+		return estimate(device, gsArgs, bytes);
+
+	const double pageCost = preflight.width * preflight.height / LETTER_AREA * deviceWeight(device) * resolutionFactor(gsArgs);
+	return preflight.pages * pageCost + preflight.imageMegapixels * IMAGE_MEGAPIXEL_COST;
+}
+
+std::size_t GSAdmission::jobs() const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _jobs;
+}
+
+Poco::UInt64 GSAdmission::bytes() const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _bytes;
+}
+
+double GSAdmission::cost() const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _cost;
+}
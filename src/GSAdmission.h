@@ -0,0 +1,98 @@
+//
+// GSAdmission.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSAdmission_INCLUDED
+#define GSAdmission_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include "GSPreflight.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+
+class GSAdmission
+	/// Bounds the conversion backlog: jobs, upload bytes and estimated
+	/// render cost admitted but not yet converted. Requests beyond the
+	/// admission.* limits are turned away before their body is read, so
+	/// a burst is pushed back to the clients (or load balancer) instead
+	/// of piling up on disk.
+	///
+	/// A job holds its share from admit() until release(), which the
+	/// worker calls once the conversion is over, whatever its outcome.
+{
+public:
+	GSAdmission(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSAdmission(const GSAdmission&) = delete;
+	GSAdmission& operator=(const GSAdmission&) = delete;
+
+	~GSAdmission();
+
+	bool admit(Job& job, Poco::UInt64 bytes, bool force = false);
+		/// Reserves room for the job if all limits allow it. A job is
+		/// always admitted into an empty backlog, however large it is,
+		/// and with force (jobs recovered after a restart) regardless.
+
+	void release(Job& job);
+		/// Gives the job's share back. Safe to call more than once.
+
+	void reestimate(Job& job, double cost);
+		/// Replaces the job's admitted cost, once the upload has been
+		/// preflighted and a better estimate is known.
+
+	int retryAfter() const { return _retryAfter; }
+		/// Seconds rejected clients are told to wait.
+
+	static double estimate(const std::string& device, const std::vector<std::string>& gsArgs, Poco::UInt64 bytes);
+		/// Rough render cost in megabytes of monochrome output at 300 dpi:
+		/// the upload size, weighted by device depth and resolution.
+
+	static double estimate(const std::string& device, const std::vector<std::string>& gsArgs, Poco::UInt64 bytes,
+		const GSPreflightResult& preflight);
+		/// The same cost from the preflight: pages of the given media size,
+		/// plus the images to decode. Falls back to the upload size when
+		/// the page count is unknown.
+
+	std::size_t jobs() const;
+	Poco::UInt64 bytes() const;
+	double cost() const;
+	Poco::UInt64 rejected() const { return _rejected; }
+
+private:
+	std::size_t _maxJobs;		// 0: unlimited
+	Poco::UInt64 _maxBytes;		// 0: unlimited
+	double _maxCost;			// 0: unlimited
+	int _retryAfter;
+	std::size_t _jobs = 0;
+	Poco::UInt64 _bytes = 0;
+	double _cost = 0;
+	std::atomic<Poco::UInt64> _rejected{0};
+	Poco::Logger& _logger;
+	mutable Poco::FastMutex _mutex;
+};
+
+
+#endif // GSAdmission_INCLUDED
@@ -0,0 +1,186 @@
+//
+// GSDeadLetter.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSDeadLetter.h"
+
+#include "Poco/AutoPtr.h"
+#include "Poco/DirectoryIterator.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/UUIDGenerator.h"
+#include "Poco/Util/PropertyFileConfiguration.h"
+
+#include <algorithm>
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+GSDeadLetter::GSDeadLetter(LayeredConfiguration& config, Logger& logger) :
+	_logger(logger)
+{
+	Poco::Path dir(Poco::Path::forDirectory(config.getString("filesDir")));
+	dir.pushDirectory("deadletter");
+	_dir = Poco::Path::forDirectory(config.getString("sender.deadLetterDir", dir.toString())).toString();
+	Poco::File(_dir).createDirectories();
+
+	load();
+	if (!_entries.empty())
+		_logger.warning("Dead letter spool [%s] holds %z undelivered job(s).", _dir, _entries.size());
+}
+
+GSDeadLetter::~GSDeadLetter()
+{
+}
+
+std::string GSDeadLetter::add(const Job& job, std::size_t index, const std::string& error, int attempts)
+{
+	DeadLetter entry;
+	entry.id = Poco::UUIDGenerator::defaultGenerator().createRandom().toString();
+	entry.jobId = job.jobId;
+	entry.printer = job.printers[index];
+	entry.inputPath = job.inputPath;
+	entry.outputPath = job.outputPath;
+	entry.device = job.device;
+	entry.formatLabel = job.formatLabel;
+	entry.error = error;
+	entry.attempts = attempts;
+
+	AutoPtr<PropertyFileConfiguration> pProps(new PropertyFileConfiguration);
+	pProps->setString("job", entry.jobId);
+	pProps->setString("printer", entry.printer);
+	pProps->setString("input", entry.inputPath);
+	pProps->setString("output", entry.outputPath);
+	pProps->setString("device", entry.device);
+	pProps->setString("format", entry.formatLabel);
+	pProps->setString("error", entry.error);
+	pProps->setInt("attempts", entry.attempts);
+	pProps->setInt64("failed", entry.failed.epochMicroseconds());
+	try
+	{
+		pProps->save(path(entry.id));
+	}
+	catch (Poco::Exception& ex)
+	{
+		_logger.error("Cannot spool dead letter for %s: %s", entry.printer, ex.displayText());
+	}
+
+	_logger.warning("Delivery of [%s] to %s dead-lettered as %s after %d attempt(s).",
+		entry.outputPath, entry.printer, entry.id, attempts);
+
+	FastMutex::ScopedLock lock(_mutex);
+	_entries[entry.id] = entry;
+	return entry.id;
+}
+
+std::vector<DeadLetter> GSDeadLetter::list() const
+{
+	std::vector<DeadLetter> entries;
+	{
+		FastMutex::ScopedLock lock(_mutex);
+		entries.reserve(_entries.size());
+		for (const auto& e : _entries)
+			entries.push_back(e.second);
+	}
+	std::sort(entries.begin(), entries.end(),
+		[](const DeadLetter& a, const DeadLetter& b) { return a.failed < b.failed; });
+	return entries;
+}
+
+bool GSDeadLetter::find(const std::string& id, DeadLetter& entry) const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	auto it = _entries.find(id);
+	if (it == _entries.end())
+		return false;
+	entry = it->second;
+	return true;
+}
+
+bool GSDeadLetter::references(const std::string& outputPath) const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	for (const auto& e : _entries)
+	{
+		if (e.second.outputPath == outputPath)
+			return true;
+	}
+	return false;
+}
+
+bool GSDeadLetter::remove(const std::string& id)
+{
+	{
+		FastMutex::ScopedLock lock(_mutex);
+		if (_entries.erase(id) == 0)
+			return false;
+	}
+	try
+	{
+		Poco::File(path(id)).remove();
+	}
+	catch (Poco::Exception& ex)
+	{
+		_logger.warning("Cannot remove dead letter %s: %s", id, ex.displayText());
+	}
+	return true;
+}
+
+std::size_t GSDeadLetter::size() const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _entries.size();
+}
+
+std::string GSDeadLetter::path(const std::string& id) const
+{
+	return Poco::Path(_dir, id + ".properties").toString();
+}
+
+void GSDeadLetter::load()
+{
+	for (Poco::DirectoryIterator it(_dir), end; it != end; ++it)
+	{
+		if (!it->isFile() || it.path().getExtension() != "properties")
+			continue;
+		try
+		{
+			AutoPtr<PropertyFileConfiguration> pProps(new PropertyFileConfiguration(it.path().toString()));
+			DeadLetter entry;
+			entry.id = it.path().getBaseName();
+			entry.jobId = pProps->getString("job", "");
+			entry.printer = pProps->getString("printer");
+			entry.inputPath = pProps->getString("input", "");
+			entry.outputPath = pProps->getString("output");
+			entry.device = pProps->getString("device", "");
+			entry.formatLabel = pProps->getString("format", "");
+			entry.error = pProps->getString("error", "");
+			entry.attempts = pProps->getInt("attempts", 0);
+			entry.failed = Poco::Timestamp(pProps->getInt64("failed", 0));
+			_entries[entry.id] = entry;
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.warning("Skipping dead letter [%s]: %s", it.path().toString(), ex.displayText());
+		}
+	}
+}
@@ -0,0 +1,92 @@
+//
+// GSDeadLetter.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSDeadLetter_INCLUDED
+#define GSDeadLetter_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include <map>
+#include <string>
+#include <vector>
+
+
+struct DeadLetter
+	/// A delivery to one printer that failed all its attempts.
+{
+	std::string id;
+	std::string jobId;
+	std::string printer;
+	std::string inputPath;
+	std::string outputPath;
+	std::string device;
+	std::string formatLabel;
+	std::string error;
+	int attempts = 0;
+	Poco::Timestamp failed;
+};
+
+
+class GSDeadLetter
+	/// Spool of deliveries that exhausted their retries, one properties
+	/// file per entry in sender.deadLetterDir (default filesDir/deadletter/),
+	/// so entries survive a restart. The converted files stay in place until
+	/// an entry is replayed or dropped through /deadletter.
+{
+public:
+	GSDeadLetter(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSDeadLetter(const GSDeadLetter&) = delete;
+	GSDeadLetter& operator=(const GSDeadLetter&) = delete;
+
+	~GSDeadLetter();
+
+	std::string add(const Job& job, std::size_t index, const std::string& error, int attempts);
+		/// Spools the delivery of job to job.printers[index] and returns the entry ID.
+
+	std::vector<DeadLetter> list() const;
+		/// All entries, oldest first.
+
+	bool find(const std::string& id, DeadLetter& entry) const;
+
+	bool remove(const std::string& id);
+		/// Drops the entry; returns false if there is none.
+
+	bool references(const std::string& outputPath) const;
+		/// Whether an entry still needs the output file, to replay it.
+
+	std::size_t size() const;
+
+private:
+	std::string path(const std::string& id) const;
+	void load();
+
+	std::string _dir;
+	std::map<std::string, DeadLetter> _entries;
+	Poco::Logger& _logger;
+	mutable Poco::FastMutex _mutex;
+};
+
+
+#endif // GSDeadLetter_INCLUDED
@@ -21,6 +21,14 @@
 
 #include "GSHTTPTask.h"
 #include "GSNotification.h"
+#include "GSResultCache.h"
+#include "GSJobTable.h"
+#include "GSMetrics.h"
+#include "GSAdmission.h"
+#include "GSScheduler.h"
+#include "GSDeadLetter.h"
+#include "GSJournal.h"
+#include "GSSubmission.h"
 
 
 #include "Poco/NotificationQueue.h"
@@ -34,12 +42,25 @@
 #include "Poco/URI.h"
 #include "Poco/Path.h"
 #include "Poco/File.h"
+#include "Poco/FileStream.h"
 #include "Poco/StreamCopier.h"
 #include "Poco/StringTokenizer.h"
+#include "Poco/NumberParser.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/SHA1Engine.h"
+#include "Poco/DigestStream.h"
+#include "Poco/TeeStream.h"
+#include "Poco/UTF8String.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/DateTimeFormat.h"
+#include "Poco/DateTimeParser.h"
+#include "Poco/DateTime.h"
+#include "Poco/Timespan.h"
 
 #include <vector>
 #include <fstream> 
 #include <algorithm>
+#include <sstream>
 #include <cctype>
 
 using namespace Poco;
@@ -48,190 +69,470 @@ using namespace Poco::Util;
 
 
 class GSCmdHandler : public HTTPRequestHandler
+	/// POST conversion requests on the threaded server, see GSSubmission.
 {
 public:
-	GSCmdHandler(Poco::NotificationQueue& ConvQ, const std::string& filesDir)
-		: _convQ(ConvQ), _dir(filesDir), _logger(Poco::Logger::get("GSHTTP"))
+	explicit GSCmdHandler(GSSubmission& submission)
+		: _submission(submission)
 	{
 	}
 
 	void handleRequest(HTTPServerRequest& req, HTTPServerResponse& resp) override
 	{
+		GSReply reply;
+		JobPtr job;
 		try {
-			// Checking wether method is POST, if not respond as ERROR
-			if (req.getMethod() != HTTPRequest::HTTP_POST) 
+			job = _submission.open(req, resp, reply);
+			if (job)
 			{
-				sendBadRequest(req, resp, HTTPResponse::HTTP_BAD_REQUEST, "Method not allowed. Use POST.");
-				return;
-			}
-
-			_logger.debug("Incoming query: %s", req.getURI());
-
-			// Query Parse
-			Poco::URI uri(req.getURI());
-			Poco::URI::QueryParameters qp = uri.getQueryParameters();
-
-			auto job = std::make_shared<Job>();
-			
-			std::string ext;						// pcl, jpg, png, ...
-			std::string device;						// pxlmono, pxlcolor, png16m, jpeg, ...
-			std::string baseName;
-			std::vector<std::string> printers;		// from print=ip:port, ip2:port, ...
-			std::vector<std::string> gsArgs;		// f.e. -q, -dNOPAUSE, -sDEVICE=pxlmono, sOutputFile= ...
-
-			for (auto& kv : qp) 
-			{
-				const std::string& k = kv.first;
-				const std::string& v = kv.second;
-
-				_logger.debug("Query param: [%s] = [%s]", kv.first, kv.second);
-
-				if (Poco::icompare(k, "print") == 0) 
+				// hashed while written, the cache and content keys need the PDF bytes
+				std::streamsize uploaded = 0;
+				bool stored = false;
+				Poco::SHA1Engine sha1;
 				{
-					Poco::StringTokenizer st(v, ",;", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
-					for (const auto& s : st) 
-						printers.push_back(s);
-					continue;
+					std::ofstream ofs(GSSubmission::partPath(*job), std::ios::binary);
+					Poco::DigestOutputStream dos(sha1);
+					Poco::TeeOutputStream tee(ofs);
+					tee.addStream(dos);
+					uploaded = Poco::StreamCopier::copyStream(req.stream(), tee);
+					tee.flush();
+					dos.flush();
+					ofs.close();
+					stored = !ofs.fail();
 				}
-				if(Poco::icompare(k, "sDEVICE") == 0)
+
+				// a client gone mid-body only ends the stream early; the job must not take the
+				// Idempotency-Key for good, nor the digest of half a document for its keys
+				if (!stored)
 				{
-					device = v;
-					continue;
+					_submission.abort(job);
+					sendBadRequest(req, resp, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, "Storing the upload failed");
+					return;
 				}
-				if (Poco::icompare(k, "sOutputFile") == 0) 
+				const Poco::Int64 expected = req.getContentLength64();
+				if (expected != HTTPMessage::UNKNOWN_CONTENT_LENGTH && uploaded != expected)
 				{
-					baseName = Poco::Path(v).getFileName();
-					_logger.debug("Base name: %s", baseName);
-					continue;
+					_submission.abort(job);
+					sendBadRequest(req, resp, HTTPResponse::HTTP_BAD_REQUEST, "Upload incomplete");
+					return;
 				}
-				// All the others are GS arg:
-				// without values: "-q", "-dNOPAUSE", "-dBATCH", "-dSAFER"
-				// with values:  "-sOutputFile=path/file.pdf", "-sDEVICE=pxlmono"
-				if (v.empty()) 
-					gsArgs.push_back("-" + k);
-				else
-					gsArgs.push_back("-" + k + "=" + v);
+				_submission.close(job, static_cast<Poco::UInt64>(uploaded), Poco::DigestEngine::digestToHex(sha1.digest()), resp, reply);
 			}
+			else if (resp.getKeepAlive())
+				drain(req);
+			_submission.wait(resp, reply);
+		}
+		catch (Poco::Exception& ex) 
+		{
+			_submission.abort(job);
+			sendBadRequest(req, resp, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, ex.displayText());
+			return;
+		}
+		catch (std::exception& ex) 
+		{
+			_submission.abort(job);
+			sendBadRequest(req, resp, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, ex.what());
+			return;
+		}
 
-			if(device.empty())
-			{
-				sendBadRequest(req, resp, HTTPResponse::HTTP_BAD_REQUEST, "Missing device name");
-				return;
-			}
+		if (reply.pOutput)
+		{
+			resp.setChunkedTransferEncoding(true);
+			auto& os = resp.send();
+			Poco::StreamCopier::copyStream(*reply.pOutput, os);
+			os.flush();
+		}
+		else
+		{
+			auto& os = resp.send();
+			os << reply.text;
+			os.flush();
+		}
+	}
 
-			if(baseName.empty())
+private:
+	static void drain(Poco::Net::HTTPServerRequest& req)
+		/// Reads and discards an unused request body, keeping the connection usable.
+	{
+		try 
+		{
+			const bool chunked = Poco::icompare(req.getTransferEncoding(),"chunked")==0;
+			if (chunked || (req.getContentLength()!=Poco::Net::HTTPMessage::UNKNOWN_CONTENT_LENGTH
+					&& req.getContentLength()>0)) 
 			{
-				sendBadRequest(req, resp, HTTPResponse::HTTP_BAD_REQUEST, "Missing file name");
-				return;
+				Poco::NullOutputStream nos;
+				Poco::StreamCopier::copyStream(req.stream(), nos);
 			}
+		} 
+		catch (...) 
+		{
+		}
+	}
 
-			// inputPath
-			Poco::Path inputPath(_dir, baseName + ".pdf"); 
-			job->inputPath = inputPath.toString();
+	void sendBadRequest(Poco::Net::HTTPServerRequest& req,
+						Poco::Net::HTTPServerResponse& resp,
+						Poco::Net::HTTPResponse::HTTPStatus st, 
+						const std::string& message)
+	{
+		drain(req);
 
-			// extension determination
-			ext = mapDevice(device);
-			if(ext == "none")
-			{
-				sendBadRequest(req, resp, HTTPResponse::HTTP_BAD_REQUEST, "Extenstion not supported");
-				return;
-			}
+		resp.setStatusAndReason(st);
+		resp.setContentType("text/plain");
+		auto& os = resp.send();
+		os << message << "\n";
+		os.flush();
+	}
 
-			// outputPath
-			Poco::Path outputPath(_dir, baseName + "." + ext); 
-			job->outputPath = outputPath.toString();
+	GSSubmission& _submission;
+};
+
+class GSJobStatusHandler : public HTTPRequestHandler
+	/// GET /jobs/{id}: state, stage timestamps and per-printer results as JSON.
+	/// DELETE /jobs/{id}: cancels the job wherever it is.
+{
+public:
+	GSJobStatusHandler(GSJobTable& jobs, GSScheduler& scheduler, Poco::NotificationQueue& sendQ,
+			GSAdmission& admission, GSJournal& journal)
+		: _jobs(jobs), _scheduler(scheduler), _sendQ(sendQ), _admission(admission), _journal(journal),
+		_logger(Poco::Logger::get("GSHTTP"))
+	{
+	}
 
-			// finish gsArgs vector - path parameters required to be at the end
-			gsArgs.push_back(std::string("-sDEVICE=") + device);
-			gsArgs.push_back(std::string("-sOutputFile=") + outputPath.toString());
-			gsArgs.push_back(inputPath.toString());
+	void handleRequest(HTTPServerRequest& req, HTTPServerResponse& resp) override
+	{
+		const std::string path = Poco::URI(req.getURI()).getPath();
+		const std::string jobId = path.substr(path.find_last_of('/') + 1);
+
+		const bool cancel = req.getMethod() == HTTPRequest::HTTP_DELETE;
+		if (req.getMethod() != HTTPRequest::HTTP_GET && !cancel)
+		{
+			sendText(resp, HTTPResponse::HTTP_METHOD_NOT_ALLOWED, "Method not allowed. Use GET or DELETE.");
+			return;
+		}
 
-			std::transform(ext.begin(), ext.end(), ext.begin(), ::toupper);
-			job->formatLabel = ext;  // PCL, PDF, JPG, ...
+		JobPtr job = _jobs.find(jobId);
+		if (!job)
+		{
+			sendText(resp, HTTPResponse::HTTP_NOT_FOUND, "Unknown job " + jobId);
+			return;
+		}
 
-			// 2) (Opcional) receive PDF body and store it on the location -> outputFile
-			bool hasBody = (req.getContentLength() != HTTPMessage::UNKNOWN_CONTENT_LENGTH && req.getContentLength() > 0);
-			if (!hasBody) 
+		HTTPResponse::HTTPStatus status = HTTPResponse::HTTP_OK;
+		if (cancel)
+		{
+			status = cancelJob(job);
+			if (status == HTTPResponse::HTTP_CONFLICT)
 			{
-				sendBadRequest(req, resp, HTTPResponse::HTTP_BAD_REQUEST, "Missing PDF body");
+				sendText(resp, status, "Job " + jobId + " already finished");
 				return;
 			}
-			Poco::File(inputPath.parent()).createDirectories();
-			{
-				std::ofstream ofs(inputPath.toString(), std::ios::binary);
-				Poco::StreamCopier::copyStream(req.stream(), ofs);
-			}
+		}
 
-			// 4) Enqueue in the print queue
-			job->gsArgs = std::move(gsArgs);
-			job->printers = std::move(printers);
-			_convQ.enqueueNotification(new JobNotification(job));
+		resp.setStatusAndReason(status);
+		resp.setContentType("application/json");
+		auto& os = resp.send();
+		writeJSON(os, *job);
+		os.flush();
+	}
 
-			// 5) Response to HTTP client
-			resp.setStatusAndReason(HTTPResponse::HTTP_OK);
-			resp.setContentType("text/plain");
-			auto& os = resp.send();
-			os << "OK enqueued " << job->printers.size() << " job(s)\n";
-			os.flush();
+private:
+	HTTPResponse::HTTPStatus cancelJob(const JobPtr& job)
+		/// A queued job is cancelled right away (200). Otherwise the request
+		/// is accepted (202): a running conversion stops at Ghostscript's
+		/// next poll (if libgs polls, see GSRenderControl), and the sender
+		/// drops whatever deliveries are left.
+	{
+		{
+			Poco::FastMutex::ScopedLock lock(job->statusMutex);
+			if (job->state == JOB_DONE || job->state == JOB_FAILED || job->state == JOB_CANCELLED)
+				return HTTPResponse::HTTP_CONFLICT;
 		}
-		catch (Poco::Exception& ex) 
+		if (job->cancelled.exchange(true))
+			return HTTPResponse::HTTP_ACCEPTED;
+
+		_logger.information("Cancelling job %s", job->jobId);
+		if (_scheduler.remove(job))
 		{
-			sendBadRequest(req, resp, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, ex.displayText());
+			_admission.release(*job);
+			job->setState(JOB_CANCELLED);
+			_journal.done(*job);
+			job->converted.set();
+			return HTTPResponse::HTTP_OK;
 		}
-		catch (std::exception& ex) 
+
+		// a job still uploading sees the flag when a worker takes it
+		_sendQ.enqueueNotification(new CancelNotification(job));
+		return HTTPResponse::HTTP_ACCEPTED;
+	}
+
+	static void writeJSON(std::ostream& os, const Job& job)
+	{
+		// formatted into memory under the lock, the sender's status updates must not wait for the client
+		std::ostringstream json;
 		{
-			sendBadRequest(req, resp, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, ex.what());
+			Poco::FastMutex::ScopedLock lock(job.statusMutex);
+			format(json, job);
 		}
+		os << json.str();
 	}
 
-	std::string mapDevice(const std::string d);
+	static void format(std::ostream& os, const Job& job)
+		/// The caller holds the job's statusMutex.
+	{
+		os << "{\"id\":\"" << job.jobId << "\""
+		   << ",\"state\":\"" << jobStateName(job.state) << "\""
+		   << ",\"priority\":\"" << jobPriorityName(job.priority) << "\""
+		   << ",\"device\":\"" << Poco::UTF8::escape(job.device, true) << "\""
+		   << ",\"output\":\"" << Poco::UTF8::escape(job.outputPath, true) << "\"";
+		if (job.pages >= 0)
+			os << ",\"pages\":" << job.pages;
+		if (job.deadline)
+			os << ",\"deadline\":\"" << Poco::DateTimeFormatter::format(Poco::Timestamp(job.deadline), Poco::DateTimeFormat::ISO8601_FRAC_FORMAT) << "\"";
+
+		os << ",\"times\":{";
+		bool first = true;
+		for (int s = 0; s < JOB_STATE_COUNT; ++s)
+		{
+			if (!job.stateTimes[s])
+				continue;
+			os << (first ? "" : ",") << "\"" << jobStateName(static_cast<JobState>(s)) << "\":\""
+			   << Poco::DateTimeFormatter::format(Poco::Timestamp(job.stateTimes[s]), Poco::DateTimeFormat::ISO8601_FRAC_FORMAT) << "\"";
+			first = false;
+		}
+		os << "}";
 
-private:
-	void sendBadRequest(Poco::Net::HTTPServerRequest& req,
-						Poco::Net::HTTPServerResponse& resp,
-						Poco::Net::HTTPResponse::HTTPStatus st, 
-						const std::string& message)
+		os << ",\"printers\":[";
+		for (std::size_t i = 0; i < job.printers.size(); ++i)
+		{
+			const PrinterResult* pResult = i < job.printerResults.size() ? &job.printerResults[i] : nullptr;
+			os << (i ? "," : "") << "{\"printer\":\"" << Poco::UTF8::escape(job.printers[i], true) << "\""
+			   << ",\"result\":\"" << printerResultName(pResult) << "\"";
+			if (pResult && pResult->attempts > 0)
+				os << ",\"attempts\":" << pResult->attempts;
+			if (pResult && !pResult->error.empty())
+				os << ",\"error\":\"" << Poco::UTF8::escape(pResult->error, true) << "\"";
+			os << "}";
+		}
+		os << "]}\n";
+	}
+
+	static const char* printerResultName(const PrinterResult* pResult)
 	{
-		try 
+		if (!pResult || !pResult->done)
+			return pResult && pResult->attempts > 0 ? "retrying" : "pending";
+		return pResult->ok ? "ok" : "failed";
+	}
+
+	static void sendText(HTTPServerResponse& resp, HTTPResponse::HTTPStatus st, const std::string& message)
+	{
+		resp.setStatusAndReason(st);
+		resp.setContentType("text/plain");
+		auto& os = resp.send();
+		os << message << "\n";
+		os.flush();
+	}
+
+	GSJobTable& _jobs;
+	GSScheduler& _scheduler;
+	Poco::NotificationQueue& _sendQ;
+	GSAdmission& _admission;
+	GSJournal& _journal;
+	Poco::Logger& _logger;
+};
+
+class GSDeadLetterHandler : public HTTPRequestHandler
+	/// Inspects and replays the dead letter spool:
+	///   GET /deadletter                     all entries as JSON
+	///   GET /deadletter/{id}                one entry
+	///   POST /deadletter/{id}/replay        sends the output to the printer again as a new job
+	///   DELETE /deadletter/{id}             drops the entry, the files are left alone
+{
+public:
+	GSDeadLetterHandler(Poco::NotificationQueue& sendQ, GSJobTable& jobs, GSAdmission& admission, GSDeadLetter& deadLetter,
+			GSJournal& journal)
+		: _sendQ(sendQ), _jobs(jobs), _admission(admission), _deadLetter(deadLetter), _journal(journal)
+	{
+	}
+
+	void handleRequest(HTTPServerRequest& req, HTTPServerResponse& resp) override
+	{
+		std::vector<std::string> segments;
+		Poco::URI(req.getURI()).getPathSegments(segments);
+		const std::string id = segments.size() > 1 ? segments[1] : std::string();
+		const bool replay = segments.size() > 2 && segments[2] == "replay";
+		const std::string& method = req.getMethod();
+
+		if (method == HTTPRequest::HTTP_GET && id.empty())
 		{
-			const bool chunked = Poco::icompare(req.getTransferEncoding(),"chunked")==0;
-			if (chunked || (req.getContentLength()!=Poco::Net::HTTPMessage::UNKNOWN_CONTENT_LENGTH
-					&& req.getContentLength()>0)) 
+			resp.setStatusAndReason(HTTPResponse::HTTP_OK);
+			resp.setContentType("application/json");
+			auto& os = resp.send();
+			os << "[";
+			bool first = true;
+			for (const auto& e : _deadLetter.list())
 			{
-				Poco::NullOutputStream nos;
-				Poco::StreamCopier::copyStream(req.stream(), nos); // drain
+				os << (first ? "" : ",");
+				writeJSON(os, e);
+				first = false;
 			}
-		} 
-		catch (...) 
+			os << "]\n";
+			os.flush();
+			return;
+		}
+
+		DeadLetter entry;
+		if (id.empty() || !_deadLetter.find(id, entry))
 		{
+			sendText(resp, HTTPResponse::HTTP_NOT_FOUND, "Unknown dead letter " + id);
+			return;
 		}
 
+		if (method == HTTPRequest::HTTP_GET && !replay)
+		{
+			resp.setStatusAndReason(HTTPResponse::HTTP_OK);
+			resp.setContentType("application/json");
+			auto& os = resp.send();
+			writeJSON(os, entry);
+			os << "\n";
+			os.flush();
+		}
+		else if (method == HTTPRequest::HTTP_POST && replay)
+		{
+			if (!Poco::File(entry.outputPath).exists())
+			{
+				sendText(resp, HTTPResponse::HTTP_CONFLICT, "Output file " + entry.outputPath + " no longer exists");
+				return;
+			}
+			auto job = std::make_shared<Job>();
+			job->inputPath = entry.inputPath;
+			job->outputPath = entry.outputPath;
+			job->device = entry.device;
+			job->formatLabel = entry.formatLabel;
+			job->printers.push_back(entry.printer);
+			_jobs.add(job);
+			job->setState(JOB_CONVERTED);
+
+			// journaled before the entry goes, a replay must survive a restart
+			if (!_journal.queued(*job))
+			{
+				job->setState(JOB_FAILED);
+				resp.set("Retry-After", Poco::NumberFormatter::format(_admission.retryAfter()));
+				sendText(resp, HTTPResponse::HTTP_SERVICE_UNAVAILABLE, "Journal unavailable, retry later");
+				return;
+			}
+
+			// whoever removes the entry replays it
+			if (!_deadLetter.remove(id))
+			{
+				job->setState(JOB_CANCELLED);
+				_journal.done(*job);
+				sendText(resp, HTTPResponse::HTTP_NOT_FOUND, "Unknown dead letter " + id);
+				return;
+			}
+			_journal.converted(*job);
+			_sendQ.enqueueNotification(new JobNotification(job));
+
+			resp.set("X-Job-Id", job->jobId);
+			sendText(resp, HTTPResponse::HTTP_ACCEPTED, "OK replaying to " + entry.printer + ", id " + job->jobId);
+		}
+		else if (method == HTTPRequest::HTTP_DELETE && !replay)
+		{
+			_deadLetter.remove(id);
+			sendText(resp, HTTPResponse::HTTP_OK, "OK dropped " + id);
+		}
+		else
+			sendText(resp, HTTPResponse::HTTP_METHOD_NOT_ALLOWED, "Method not allowed");
+	}
+
+private:
+	static void writeJSON(std::ostream& os, const DeadLetter& e)
+	{
+		os << "{\"id\":\"" << e.id << "\""
+		   << ",\"job\":\"" << e.jobId << "\""
+		   << ",\"printer\":\"" << Poco::UTF8::escape(e.printer, true) << "\""
+		   << ",\"output\":\"" << Poco::UTF8::escape(e.outputPath, true) << "\""
+		   << ",\"device\":\"" << Poco::UTF8::escape(e.device, true) << "\""
+		   << ",\"attempts\":" << e.attempts
+		   << ",\"error\":\"" << Poco::UTF8::escape(e.error, true) << "\""
+		   << ",\"failed\":\"" << Poco::DateTimeFormatter::format(e.failed, Poco::DateTimeFormat::ISO8601_FRAC_FORMAT) << "\"}";
+	}
+
+	static void sendText(HTTPServerResponse& resp, HTTPResponse::HTTPStatus st, const std::string& message)
+	{
 		resp.setStatusAndReason(st);
 		resp.setContentType("text/plain");
 		auto& os = resp.send();
 		os << message << "\n";
 		os.flush();
 	}
-	Poco::NotificationQueue& _convQ;
-	std::string _dir;
-	Poco::Logger& _logger;
+
+	Poco::NotificationQueue& _sendQ;
+	GSJobTable& _jobs;
+	GSAdmission& _admission;
+	GSDeadLetter& _deadLetter;
+	GSJournal& _journal;
 };
 
-inline std::string GSCmdHandler::mapDevice(const std::string d)
+class GSMetricsHandler : public HTTPRequestHandler
+	/// GET /metrics: pipeline counters, histograms and queue gauges in
+	/// Prometheus text format.
 {
-	// PCL
-	if (d == "pxlmono" || d == "pxlcolor" || d == "pcl3" || d == "pclm" || d == "pclm8")
-		return "pcl";
+public:
+	GSMetricsHandler(GSScheduler& scheduler, Poco::NotificationQueue& sendQ, GSResultCache& cache, GSJobTable& jobs,
+			GSAdmission& admission, GSDeadLetter& deadLetter)
+		: _scheduler(scheduler), _sendQ(sendQ), _cache(cache), _jobs(jobs), _admission(admission), _deadLetter(deadLetter)
+	{
+	}
 
-	// image
-	if (d == "png16m" || d == "png16" || d == "png48" || d == "pngalpha" || d == "pnggray" || d == "pngmono")
-		return "png";
+	void handleRequest(HTTPServerRequest& req, HTTPServerResponse& resp) override
+	{
+		resp.setStatusAndReason(HTTPResponse::HTTP_OK);
+		resp.setContentType("text/plain; version=0.0.4");
+		auto& os = resp.send();
 
-	if (d == "jpeg" || d == "jpeggray" || d == "jpegcmyk")
-		return "jpg";
+		GSMetrics::instance().write(os);
 
-	return "none";
-}
+		os << "# TYPE gsserver_queue_depth gauge\n"
+		   << "gsserver_queue_depth{queue=\"conv\"} " << _scheduler.size() << "\n"
+		   << "gsserver_queue_depth{queue=\"send\"} " << _sendQ.size() << "\n";
+		os << "# TYPE gsserver_conv_queue_depth gauge\n";
+		for (int c = 0; c < PRIORITY_COUNT; ++c)
+		{
+			const JobPriority priority = static_cast<JobPriority>(c);
+			os << "gsserver_conv_queue_depth{class=\"" << jobPriorityName(priority) << "\"} " << _scheduler.size(priority) << "\n";
+		}
+		os << "# TYPE gsserver_jobs_tracked gauge\n"
+		   << "gsserver_jobs_tracked " << _jobs.size() << "\n";
+		os << "# TYPE gsserver_dead_letters gauge\n"
+		   << "gsserver_dead_letters " << _deadLetter.size() << "\n";
+		os << "# TYPE gsserver_backlog_jobs gauge\n"
+		   << "gsserver_backlog_jobs " << _admission.jobs() << "\n"
+		   << "# TYPE gsserver_backlog_bytes gauge\n"
+		   << "gsserver_backlog_bytes " << _admission.bytes() << "\n"
+		   << "# TYPE gsserver_backlog_cost gauge\n"
+		   << "gsserver_backlog_cost " << _admission.cost() << "\n"
+		   << "# TYPE gsserver_admission_rejected_total counter\n"
+		   << "gsserver_admission_rejected_total " << _admission.rejected() << "\n";
+		if (_cache.enabled())
+		{
+			os << "# TYPE gsserver_cache_hits_total counter\n"
+			   << "gsserver_cache_hits_total " << _cache.hits() << "\n"
+			   << "# TYPE gsserver_cache_misses_total counter\n"
+			   << "gsserver_cache_misses_total " << _cache.misses() << "\n"
+			   << "# TYPE gsserver_cache_bytes gauge\n"
+			   << "gsserver_cache_bytes " << _cache.bytes() << "\n";
+		}
+		os.flush();
+	}
+
+private:
+	GSScheduler& _scheduler;
+	Poco::NotificationQueue& _sendQ;
+	GSResultCache& _cache;
+	GSJobTable& _jobs;
+	GSAdmission& _admission;
+	GSDeadLetter& _deadLetter;
+};
 
 class SimpleHandlerFactory : public HTTPRequestHandlerFactory
 {
@@ -239,33 +540,53 @@ class SimpleHandlerFactory : public HTTPRequestHandlerFactory
 public:
 	using Configuration = Poco::Util::LayeredConfiguration;
 	
-	SimpleHandlerFactory(Poco::NotificationQueue& convQ, Configuration& cfg)
-		: _convQ(convQ), _filesDir(cfg.getString("filesDir"))
+	SimpleHandlerFactory(GSScheduler& scheduler, Poco::NotificationQueue& sendQ, GSResultCache& cache,
+			GSJobTable& jobs, GSAdmission& admission, GSDeadLetter& deadLetter, GSJournal& journal, GSSubmission& submission)
+		: _scheduler(scheduler), _sendQ(sendQ), _cache(cache), _jobs(jobs), _admission(admission), _deadLetter(deadLetter),
+		_journal(journal), _submission(submission)
 	{
 	}
 
 	HTTPRequestHandler* createRequestHandler(const HTTPServerRequest& req) override
 	{
-		return new GSCmdHandler(_convQ, _filesDir);
+		const std::string path = Poco::URI(req.getURI()).getPath();
+		if (path.compare(0, 6, "/jobs/") == 0)
+			return new GSJobStatusHandler(_jobs, _scheduler, _sendQ, _admission, _journal);
+		if (path == "/deadletter" || path.compare(0, 12, "/deadletter/") == 0)
+			return new GSDeadLetterHandler(_sendQ, _jobs, _admission, _deadLetter, _journal);
+		if (path == "/metrics")
+			return new GSMetricsHandler(_scheduler, _sendQ, _cache, _jobs, _admission, _deadLetter);
+
+		return new GSCmdHandler(_submission);
 	}
 
 private:
-	Poco::NotificationQueue& _convQ;
-	std::string _filesDir;
+	GSScheduler& _scheduler;
+	Poco::NotificationQueue& _sendQ;
+	GSResultCache& _cache;
+	GSJobTable& _jobs;
+	GSAdmission& _admission;
+	GSDeadLetter& _deadLetter;
+	GSJournal& _journal;
+	GSSubmission& _submission;
 };
 
 // ---- GSHTTPTask ----
 
-GSHTTPTask::GSHTTPTask(Configuration& cfg, Poco::NotificationQueue& convQ, const std::string& taskName)
+GSHTTPTask::GSHTTPTask(Configuration& cfg, GSScheduler& scheduler, Poco::NotificationQueue& sendQ,
+		GSResultCache& cache, GSJobTable& jobs, GSAdmission& admission, GSDeadLetter& deadLetter, GSJournal& journal,
+		GSSubmission& submission, const std::string& taskName)
 	: Poco::Task(taskName)
 	, _serverSocket(Poco::Net::SocketAddress(cfg.getString("http.server.address", "0.0.0.0:9980")))
-	, _pReqHandlerFactory(new SimpleHandlerFactory(convQ, cfg))
+	, _pReqHandlerFactory(new SimpleHandlerFactory(scheduler, sendQ, cache, jobs, admission, deadLetter, journal, submission))
 	, _httpParams(new Poco::Net::HTTPServerParams)
 	, _httpServer(_pReqHandlerFactory, _serverSocket, _httpParams)
 	, _logger(Poco::Logger::get(name()))
 {
 	_httpParams->setMaxQueued(cfg.getInt("http.server.maxQueued", 100));
 	_httpParams->setMaxThreads(cfg.getInt("http.server.maxThreads", 16));
+	// bounds every read and write of a connection; there is no minimum rate here, see ingest.address
+	_httpParams->setTimeout(Poco::Timespan(cfg.getInt("http.server.timeout", 60), 0));
 
 	_httpServer.start();
 	_logger.information("%s created, listening on %s.", name(), _serverSocket.address().toString());
@@ -33,6 +33,16 @@
 #include "Poco/NotificationQueue.h"
 #include <atomic>
 
+
+class GSResultCache;
+class GSJobTable;
+class GSAdmission;
+class GSScheduler;
+class GSDeadLetter;
+class GSJournal;
+class GSSubmission;
+
+
 class GSHTTPTask : public Poco::Task
 {
 public:
@@ -44,7 +54,9 @@ public:
 	GSHTTPTask& operator=(const GSHTTPTask&) = delete;
 	GSHTTPTask& operator=(GSHTTPTask&&) = delete;
 
-	explicit GSHTTPTask(Configuration& cfg,  Poco::NotificationQueue& nq, const std::string& taskName = "GSHTTPTask");
+	GSHTTPTask(Configuration& cfg, GSScheduler& scheduler, Poco::NotificationQueue& sendQ,
+		GSResultCache& cache, GSJobTable& jobs, GSAdmission& admission, GSDeadLetter& deadLetter, GSJournal& journal,
+		GSSubmission& submission, const std::string& taskName = "GSHTTPTask");
 
 	virtual ~GSHTTPTask();
 
@@ -0,0 +1,664 @@
+//
+// GSIngest.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSIngest.h"
+#include "GSMetrics.h"
+
+#include "Poco/AutoPtr.h"
+#include "Poco/Error.h"
+#include "Poco/Exception.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/URI.h"
+#include "Poco/Net/NetException.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace Poco;
+using namespace Poco::Net;
+using namespace Poco::Util;
+
+
+namespace
+{
+	// how long the loop sleeps when no socket is ready; also the
+	// granularity of the read timeout and rate checks
+	const Timespan POLL_INTERVAL(0, 100000);
+
+	// most a single connection reads per wakeup, so a fast
+	// client cannot hold up the others
+	const std::size_t READ_BUDGET = 1024 * 1024;
+
+	const std::size_t BUFFER_SIZE = 64 * 1024;
+
+	// request line and headers
+	const std::size_t MAX_HEAD = 16 * 1024;
+
+	const std::string CONTINUE = "HTTP/1.1 100 Continue\r\n\r\n";
+
+	// how long a connection answered before its body was read is read off
+	// before it is closed, see GSIngest::linger()
+	const Timespan LINGER_TIMEOUT(2, 0);
+
+	// how long answers decided before shutdown may still take to go out
+	const Timespan SHUTDOWN_DRAIN(5, 0);
+}
+
+
+GSIngest::GSIngest(GSSubmission& submission, Logger& logger, LayeredConfiguration& config) :
+	Task("GSIngest"),
+	_submission(submission),
+	_logger(logger),
+	_serverSocket(SocketAddress(config.getString("ingest.address"))),
+	_readTimeout(config.getInt("ingest.readTimeout", 30), 0),
+	_minRateGrace(config.getInt("ingest.minRateGrace", 10), 0),
+	_minRate(config.getDouble("ingest.minRate", 4096)),
+	_maxConnections(static_cast<std::size_t>(std::max(1, config.getInt("ingest.maxConnections", 1000)))),
+	_sendTimeout(config.getInt("ingest.sendTimeout", 30), 0),
+	_buffer(BUFFER_SIZE),
+	_completer(*this, &GSIngest::complete)
+{
+	_serverSocket.setBlocking(false);
+	const int threads = std::max(1, config.getInt("ingest.threads", 4));
+	for (int i = 0; i < threads; ++i)
+	{
+		_threads.emplace_back(new Poco::Thread("GSIngest-" + NumberFormatter::format(i + 1)));
+		_threads.back()->start(_completer);
+	}
+	_logger.information("Upload ingest listening on %s, %d completion thread(s).", _serverSocket.address().toString(), threads);
+}
+
+GSIngest::~GSIngest()
+{
+	// stops the completion threads when runTask never ran
+	for (auto& pThread : _threads)
+	{
+		if (pThread->isRunning())
+			_completed.enqueueNotification(new Poco::Notification);
+	}
+	for (auto& pThread : _threads)
+		pThread->join();
+}
+
+void GSIngest::runTask()
+{
+	_pollSet.add(_serverSocket, PollSet::POLL_READ);
+	while (!isCancelled())
+	{
+		handle(_pollSet.poll(POLL_INTERVAL));
+		collect();
+		expire();
+	}
+
+	// uploads still arriving are given up, the clients retry them
+	for (auto it = _connections.begin(); it != _connections.end(); )
+	{
+		auto next = std::next(it);
+		if (it->second->phase == Connection::READING)
+			drop(it, HTTPResponse::HTTP_SERVICE_UNAVAILABLE, "shutting down");
+		it = next;
+	}
+	_pollSet.remove(_serverSocket);
+	_serverSocket.close();
+
+	// one stop per thread, queued behind the uploads still to be queued
+	for (std::size_t i = 0; i < _threads.size(); ++i)
+		_completed.enqueueNotification(new Poco::Notification);
+	for (auto& pThread : _threads)
+		pThread->join();
+	collect();
+
+	// sync requests stop waiting and leave their jobs to the workers and the sender
+	for (auto it = _connections.begin(); it != _connections.end(); )
+	{
+		auto next = std::next(it);
+		Connection& c = *it->second;
+		if (c.phase == Connection::WAITING)
+		{
+			try
+			{
+				_submission.settle(c.response, c.reply, true);
+				answer(it);
+			}
+			catch (Poco::Exception& ex)
+			{
+				_logger.warning("Settling the answer to %s failed: %s", c.peer.toString(), ex.displayText());
+				release(it);
+			}
+		}
+		it = next;
+	}
+
+	// a queued job whose client never hears of it is sent again and printed twice,
+	// so every answer decided goes out, as far as the drain time allows
+	const Timestamp draining;
+	while (!_connections.empty() && !draining.isElapsed(SHUTDOWN_DRAIN.totalMicroseconds()))
+	{
+		handle(_pollSet.poll(POLL_INTERVAL));
+		expire();
+	}
+	if (!_connections.empty())
+		_logger.warning("%z answer(s) not sent on shutdown", _connections.size());
+	while (!_connections.empty())
+		release(_connections.begin());
+	_pollSet.clear();
+	_logger.information("Upload ingest stopped.");
+}
+
+void GSIngest::handle(const PollSet::SocketModeMap& ready)
+{
+	for (const auto& r : ready)
+	{
+		if (r.first == _serverSocket)
+		{
+			accept();
+			continue;
+		}
+		auto it = _connections.find(r.first.impl()->sockfd());
+		if (it == _connections.end())
+			continue;
+		switch (it->second->phase)
+		{
+		case Connection::READING:
+			read(it);
+			break;
+		case Connection::WRITING:
+			write(it);
+			break;
+		case Connection::LINGERING:
+			discard(it);
+			break;
+		case Connection::WAITING:
+			break;
+		}
+	}
+}
+
+void GSIngest::accept()
+{
+	StreamSocket socket;
+	SocketAddress peer;
+	try
+	{
+		socket = _serverSocket.acceptConnection(peer);
+	}
+	catch (Poco::Exception&)
+	{
+		// the client gave up before we got to it
+		return;
+	}
+	if (_connections.size() >= _maxConnections)
+	{
+		_logger.warning("Ingest connection limit (%z) reached, refusing %s", _maxConnections, peer.toString());
+		socket.close();
+		return;
+	}
+
+	std::unique_ptr<Connection> pConnection(new Connection);
+	pConnection->socket = socket;
+	pConnection->peer = peer;
+	socket.setBlocking(false);
+	_pollSet.add(socket, PollSet::POLL_READ | PollSet::POLL_ERROR);
+	_connections[socket.impl()->sockfd()] = std::move(pConnection);
+}
+
+void GSIngest::read(ConnectionMap::iterator it)
+{
+	Connection& c = *it->second;
+	try
+	{
+		// the rest of a 100 Continue the send buffer did not take at once
+		if (c.outSent < c.out.size() && flush(c))
+			_pollSet.update(c.socket, PollSet::POLL_READ | PollSet::POLL_ERROR);
+
+		std::size_t budget = READ_BUDGET;
+		while (budget > 0)
+		{
+			// a non-blocking socket returns -1 when there is nothing more to read
+			const int n = c.socket.receiveBytes(_buffer.data(), static_cast<int>(std::min(_buffer.size(), budget)));
+			if (n < 0)
+				return;
+			if (n == 0)
+			{
+				drop(it, HTTPResponse::HTTP_BAD_REQUEST, "connection closed by the client");
+				return;
+			}
+			budget -= static_cast<std::size_t>(n);
+			c.lastRead.update();
+
+			if (c.job)
+				store(c, _buffer.data(), static_cast<std::size_t>(n));
+			else
+			{
+				c.head.append(_buffer.data(), static_cast<std::size_t>(n));
+				const std::string::size_type end = c.head.find("\r\n\r\n");
+				if (end == std::string::npos)
+				{
+					if (c.head.size() > MAX_HEAD)
+					{
+						drop(it, HTTPResponse::HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE, "request head too large");
+						return;
+					}
+					continue;
+				}
+
+				std::istringstream is(c.head.substr(0, end + 4));
+				c.request.read(is);
+				const std::string body = c.head.substr(end + 4);
+				c.head.clear();
+				if (!readHead(c))
+				{
+					// answered on the head alone, nothing to queue; the body is read off after the answer
+					const Poco::Int64 length = c.request.getContentLength64();
+					c.expected = length > 0 ? static_cast<Poco::UInt64>(length) : 0;
+					c.received = std::min<Poco::UInt64>(body.size(), c.expected);
+					respond(it);
+					return;
+				}
+				store(c, body.data(), body.size());
+			}
+
+			if (c.received >= c.expected)
+			{
+				handOver(it);
+				return;
+			}
+		}
+	}
+	catch (MessageException& ex)
+	{
+		drop(it, HTTPResponse::HTTP_BAD_REQUEST, ex.displayText());
+	}
+	catch (Poco::Exception& ex)
+	{
+		drop(it, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, ex.displayText());
+	}
+}
+
+bool GSIngest::readHead(Connection& c)
+{
+	const std::string path = Poco::URI(c.request.getURI()).getPath();
+	if (path.compare(0, 6, "/jobs/") == 0 || path.compare(0, 11, "/deadletter") == 0 || path == "/metrics")
+	{
+		c.response.setStatusAndReason(HTTPResponse::HTTP_NOT_FOUND);
+		c.response.setContentType("text/plain");
+		c.reply.text = "Conversion uploads only, ask the HTTP server for " + path + "\n";
+		return false;
+	}
+
+	c.job = _submission.open(c.request, c.response, c.reply);
+	if (!c.job)
+		return false;
+
+	c.expected = static_cast<Poco::UInt64>(c.request.getContentLength64());
+	const std::string partPath = GSSubmission::partPath(*c.job);
+	c.fd = ::open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (c.fd < 0)
+		throw CreateFileException(partPath, Error::getMessage(Error::last()));
+
+	// a client holding the body back for the go-ahead gets it once the
+	// job is admitted; what the send buffer does not take goes when it can
+	if (c.request.getExpectContinue())
+	{
+		c.out = CONTINUE;
+		c.outSent = 0;
+		if (!flush(c))
+			_pollSet.update(c.socket, PollSet::POLL_READ | PollSet::POLL_WRITE | PollSet::POLL_ERROR);
+	}
+	return true;
+}
+
+void GSIngest::store(Connection& c, const char* data, std::size_t length)
+{
+	// bytes past the Content-Length belong to no request
+	length = static_cast<std::size_t>(std::min<Poco::UInt64>(length, c.expected - c.received));
+	std::size_t written = 0;
+	while (written < length)
+	{
+		const ssize_t w = ::write(c.fd, data + written, length - written);
+		if (w < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw WriteFileException(GSSubmission::partPath(*c.job), Error::getMessage(Error::last()));
+		}
+		written += static_cast<std::size_t>(w);
+	}
+	c.sha1.update(data, length);
+	c.received += length;
+}
+
+void GSIngest::expire()
+{
+	const Timestamp now;
+	const Timestamp::TimeDiff syncTimeout = _submission.syncTimeout().totalMicroseconds();
+	for (auto it = _connections.begin(); it != _connections.end(); )
+	{
+		auto next = std::next(it);
+		Connection& c = *it->second;
+		const Timestamp::TimeDiff elapsed = now - c.started;
+		switch (c.phase)
+		{
+		case Connection::READING:
+			if (_readTimeout.totalMicroseconds() > 0 && now - c.lastRead > _readTimeout.totalMicroseconds())
+			{
+				GSMetrics::instance().uploadTimeout();
+				drop(it, HTTPResponse::HTTP_REQUEST_TIMEOUT, "read timeout");
+			}
+			else if (_minRate > 0 && elapsed > _minRateGrace.totalMicroseconds() && c.received * 1e6 / elapsed < _minRate)
+			{
+				GSMetrics::instance().uploadTimeout();
+				drop(it, HTTPResponse::HTTP_REQUEST_TIMEOUT, "upload below " + NumberFormatter::format(_minRate, 0) + " bytes/s");
+			}
+			break;
+		case Connection::WAITING:
+			{
+				const bool converted = GSSubmission::awaited(c.reply)->converted.tryWait(0);
+				if (converted || now - c.waitStarted > syncTimeout)
+				{
+					try
+					{
+						_submission.settle(c.response, c.reply, !converted);
+					}
+					catch (Poco::Exception& ex)
+					{
+						_logger.warning("Settling the answer to %s failed: %s", c.peer.toString(), ex.displayText());
+						release(it);
+						break;
+					}
+					answer(it);
+				}
+			}
+			break;
+		case Connection::WRITING:
+			if (now - c.lastWrite > _sendTimeout.totalMicroseconds())
+			{
+				_logger.warning("Answering %s timed out", c.peer.toString());
+				release(it);
+			}
+			break;
+		case Connection::LINGERING:
+			if (now - c.lingerStarted > LINGER_TIMEOUT.totalMicroseconds())
+				release(it);
+			break;
+		}
+		it = next;
+	}
+}
+
+void GSIngest::handOver(ConnectionMap::iterator it)
+{
+	std::unique_ptr<Connection> pConnection = std::move(it->second);
+	_pollSet.remove(pConnection->socket);
+	_connections.erase(it);
+	if (pConnection->fd >= 0)
+	{
+		::close(pConnection->fd);
+		pConnection->fd = -1;
+	}
+	_completed.enqueueNotification(new Completed(std::move(pConnection)));
+}
+
+void GSIngest::drop(ConnectionMap::iterator it, HTTPResponse::HTTPStatus status, const std::string& reason)
+{
+	Connection& c = *it->second;
+	_logger.warning("Upload from %s dropped after %Lu byte(s): %s", c.peer.toString(), c.received, reason);
+	if (c.fd >= 0)
+	{
+		::close(c.fd);
+		c.fd = -1;
+	}
+	_submission.abort(c.job);
+	c.job.reset();
+
+	// answered like any other request, then the rest of the body is read off
+	c.response.clear();
+	c.response.setStatusAndReason(status);
+	c.response.setContentType("text/plain");
+	c.reply.pOutput.reset();
+	c.reply.text = reason + "\n";
+	answer(it);
+}
+
+void GSIngest::complete()
+{
+	for (;;)
+	{
+		Poco::AutoPtr<Poco::Notification> pNf(_completed.waitDequeueNotification());
+		Completed* pCompleted = dynamic_cast<Completed*>(pNf.get());
+		if (!pCompleted)
+			break;
+		submit(*pCompleted->connection);
+		_submitted.enqueueNotification(new Completed(std::move(pCompleted->connection)));
+	}
+}
+
+void GSIngest::submit(Connection& c)
+{
+	if (!c.job)
+		return;
+	try
+	{
+		_submission.close(c.job, c.received, DigestEngine::digestToHex(c.sha1.digest()), c.response, c.reply);
+	}
+	catch (Poco::Exception& ex)
+	{
+		_logger.error(ex.displayText());
+		_submission.abort(c.job);
+		c.response.setStatusAndReason(HTTPResponse::HTTP_INTERNAL_SERVER_ERROR);
+		c.response.setContentType("text/plain");
+		c.reply.pSync.reset();
+		c.reply.pOutput.reset();
+		c.reply.text = ex.displayText() + "\n";
+	}
+}
+
+void GSIngest::collect()
+{
+	for (;;)
+	{
+		Poco::AutoPtr<Poco::Notification> pNf(_submitted.dequeueNotification());
+		Completed* pCompleted = dynamic_cast<Completed*>(pNf.get());
+		if (!pCompleted)
+			break;
+		const poco_socket_t fd = pCompleted->connection->socket.impl()->sockfd();
+		respond(_connections.emplace(fd, std::move(pCompleted->connection)).first);
+	}
+}
+
+void GSIngest::respond(ConnectionMap::iterator it)
+{
+	Connection& c = *it->second;
+	if (GSSubmission::awaited(c.reply))
+	{
+		// parked until the conversion ends, see expire()
+		if (_pollSet.has(c.socket))
+			_pollSet.remove(c.socket);
+		c.phase = Connection::WAITING;
+		c.waitStarted.update();
+		return;
+	}
+	answer(it);
+}
+
+void GSIngest::answer(ConnectionMap::iterator it)
+{
+	Connection& c = *it->second;
+	try
+	{
+		c.response.setKeepAlive(false);
+		c.response.setDate(Timestamp());
+		if (c.reply.pOutput)
+		{
+			std::istream& output = *c.reply.pOutput;
+			output.seekg(0, std::ios::end);
+			c.response.setContentLength64(static_cast<Poco::Int64>(output.tellg()));
+			output.seekg(0);
+		}
+		else
+			c.response.setContentLength(static_cast<std::streamsize>(c.reply.text.size()));
+		std::ostringstream head;
+		c.response.write(head);
+		c.out = head.str();
+		if (!c.reply.pOutput)
+			c.out += c.reply.text;
+	}
+	catch (Poco::Exception& ex)
+	{
+		_logger.warning("Answering %s failed: %s", c.peer.toString(), ex.displayText());
+		release(it);
+		return;
+	}
+
+	c.phase = Connection::WRITING;
+	c.outSent = 0;
+	c.lastWrite.update();
+	if (_pollSet.has(c.socket))
+		_pollSet.update(c.socket, PollSet::POLL_WRITE | PollSet::POLL_ERROR);
+	else
+		_pollSet.add(c.socket, PollSet::POLL_WRITE | PollSet::POLL_ERROR);
+}
+
+void GSIngest::write(ConnectionMap::iterator it)
+{
+	Connection& c = *it->second;
+	try
+	{
+		std::size_t budget = READ_BUDGET;
+		while (budget > 0)
+		{
+			if (c.outSent == c.out.size())
+			{
+				// the head and text went first, the output follows a buffer at a time
+				c.out.clear();
+				c.outSent = 0;
+				if (c.reply.pOutput)
+				{
+					c.out.resize(BUFFER_SIZE);
+					c.reply.pOutput->read(&c.out[0], static_cast<std::streamsize>(c.out.size()));
+					c.out.resize(static_cast<std::size_t>(c.reply.pOutput->gcount()));
+				}
+				if (c.out.empty())
+				{
+					finish(it);
+					return;
+				}
+			}
+
+			const std::size_t pending = c.out.size() - c.outSent;
+			if (!flush(c))
+				return;
+			budget -= std::min(budget, pending);
+		}
+	}
+	catch (Poco::Exception& ex)
+	{
+		_logger.warning("Answering %s failed: %s", c.peer.toString(), ex.displayText());
+		release(it);
+	}
+}
+
+bool GSIngest::flush(Connection& c)
+{
+	while (c.outSent < c.out.size())
+	{
+		// a non-blocking socket returns -1 when its send buffer is full
+		const int n = c.socket.sendBytes(c.out.data() + c.outSent, static_cast<int>(c.out.size() - c.outSent));
+		if (n < 0)
+			return false;
+		c.outSent += static_cast<std::size_t>(n);
+		c.lastWrite.update();
+	}
+	return true;
+}
+
+void GSIngest::finish(ConnectionMap::iterator it)
+{
+	Connection& c = *it->second;
+	if (c.received >= c.expected)
+	{
+		release(it);
+		return;
+	}
+
+	// closed with the body unread, the connection would be reset and the
+	// client could lose the answer before reading it: the sending side is
+	// shut down and the rest read off for a while, see discard()
+	try
+	{
+		c.socket.shutdownSend();
+	}
+	catch (Poco::Exception&)
+	{
+		release(it);
+		return;
+	}
+	c.phase = Connection::LINGERING;
+	c.lingerStarted.update();
+	if (_pollSet.has(c.socket))
+		_pollSet.update(c.socket, PollSet::POLL_READ | PollSet::POLL_ERROR);
+	else
+		_pollSet.add(c.socket, PollSet::POLL_READ | PollSet::POLL_ERROR);
+}
+
+void GSIngest::discard(ConnectionMap::iterator it)
+{
+	Connection& c = *it->second;
+	try
+	{
+		std::size_t budget = READ_BUDGET;
+		while (budget > 0)
+		{
+			const int n = c.socket.receiveBytes(_buffer.data(), static_cast<int>(std::min(_buffer.size(), budget)));
+			if (n < 0)
+				return;
+			c.received += static_cast<Poco::UInt64>(n);
+			if (n == 0 || c.received >= c.expected)
+				break;
+			budget -= static_cast<std::size_t>(n);
+		}
+		if (budget == 0)
+			return;
+	}
+	catch (Poco::Exception&)
+	{
+	}
+	release(it);
+}
+
+void GSIngest::release(ConnectionMap::iterator it)
+{
+	Connection& c = *it->second;
+	try
+	{
+		if (_pollSet.has(c.socket))
+			_pollSet.remove(c.socket);
+	}
+	catch (Poco::Exception&)
+	{
+	}
+	c.socket.close();
+	_connections.erase(it);
+}
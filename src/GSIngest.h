@@ -0,0 +1,164 @@
+//
+// GSIngest.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSIngest_INCLUDED
+#define GSIngest_INCLUDED
+
+
+#include "Poco/Task.h"
+#include "Poco/Logger.h"
+#include "Poco/Notification.h"
+#include "Poco/NotificationQueue.h"
+#include "Poco/RunnableAdapter.h"
+#include "Poco/SHA1Engine.h"
+#include "Poco/Thread.h"
+#include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Net/HTTPRequest.h"
+#include "Poco/Net/HTTPResponse.h"
+#include "Poco/Net/PollSet.h"
+#include "Poco/Net/SocketAddress.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include "GSSubmission.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+class GSIngest : public Poco::Task
+	/// Receives conversion uploads on a port of their own (ingest.address)
+	/// from a single event loop, so a client on a slow link costs a socket
+	/// and a spool file instead of one of the http.server.maxThreads threads.
+	///
+	/// The request head is read and the job admitted (GSSubmission::open)
+	/// before any of the body is taken, so overload still answers 503 up
+	/// front. The body goes straight into the spool. A connection is dropped
+	/// with 408 when nothing arrives for ingest.readTimeout seconds, or when
+	/// it delivers less than ingest.minRate bytes per second once
+	/// ingest.minRateGrace seconds have passed.
+	///
+	/// Only complete uploads reach the ingest.threads completion threads,
+	/// which queue the job (GSSubmission::close) and hand the connection
+	/// back. The loop parks a sync request until its conversion ends or
+	/// sync.timeout passes, and writes every answer without blocking; an
+	/// answer that stalls for ingest.sendTimeout seconds is cut off. A
+	/// request answered before its body was read (refused, dropped) has
+	/// the rest read off for a moment before the socket closes, so the
+	/// client gets to read the answer. On shutdown the answers already
+	/// decided still go out, for a few seconds at most.
+	/// Every connection carries one request.
+{
+public:
+	GSIngest(GSSubmission& submission, Poco::Logger& logger, Poco::Util::LayeredConfiguration& config);
+	GSIngest(const GSIngest&) = delete;
+	GSIngest& operator=(const GSIngest&) = delete;
+
+	~GSIngest();
+
+	void runTask() override;
+
+private:
+	struct Connection
+	{
+		enum Phase
+		{
+			READING,					// request head and body
+			WAITING,					// sync: for the conversion
+			WRITING,					// the answer
+			LINGERING					// the body left unread, before closing
+		};
+
+		Phase phase = READING;
+		Poco::Net::StreamSocket socket;
+		Poco::Net::SocketAddress peer;
+		std::string head;				// request line and headers, until complete
+		Poco::Net::HTTPRequest request;
+		Poco::Net::HTTPResponse response;
+		GSReply reply;
+		JobPtr job;						// admitted, its body arriving
+		int fd = -1;					// the part file
+		Poco::SHA1Engine sha1;
+		Poco::UInt64 expected = 0;		// Content-Length
+		Poco::UInt64 received = 0;
+		Poco::Timestamp started;
+		Poco::Timestamp lastRead;
+		Poco::Timestamp waitStarted;
+		std::string out;				// answer (or 100 Continue) bytes, sent up to outSent
+		std::size_t outSent = 0;
+		Poco::Timestamp lastWrite;
+		Poco::Timestamp lingerStarted;
+	};
+
+	using ConnectionMap = std::map<poco_socket_t, std::unique_ptr<Connection>>;
+
+	class Completed : public Poco::Notification
+	{
+	public:
+		explicit Completed(std::unique_ptr<Connection> pConnection) :
+			connection(std::move(pConnection))
+		{
+		}
+
+		std::unique_ptr<Connection> connection;
+	};
+
+	void handle(const Poco::Net::PollSet::SocketModeMap& ready);
+	void accept();
+	void read(ConnectionMap::iterator it);
+	bool readHead(Connection& c);
+	void store(Connection& c, const char* data, std::size_t length);
+	void expire();
+	void handOver(ConnectionMap::iterator it);
+	void drop(ConnectionMap::iterator it, Poco::Net::HTTPResponse::HTTPStatus status, const std::string& reason);
+	void complete();
+	void submit(Connection& c);
+	void collect();
+	void respond(ConnectionMap::iterator it);
+	void answer(ConnectionMap::iterator it);
+	void write(ConnectionMap::iterator it);
+	bool flush(Connection& c);
+	void finish(ConnectionMap::iterator it);
+	void discard(ConnectionMap::iterator it);
+	void release(ConnectionMap::iterator it);
+
+	GSSubmission& _submission;
+	Poco::Logger& _logger;
+	Poco::Net::ServerSocket _serverSocket;
+	Poco::Timespan _readTimeout;
+	Poco::Timespan _minRateGrace;
+	double _minRate;				// bytes per second, 0: no minimum
+	std::size_t _maxConnections;
+	Poco::Timespan _sendTimeout;
+	Poco::Net::PollSet _pollSet;
+	ConnectionMap _connections;		// by socket descriptor
+	std::vector<char> _buffer;		// shared by all connections
+	Poco::NotificationQueue _completed;
+	Poco::NotificationQueue _submitted;	// handed back by the completion threads
+	Poco::RunnableAdapter<GSIngest> _completer;
+	std::vector<std::unique_ptr<Poco::Thread>> _threads;
+};
+
+
+#endif // GSIngest_INCLUDED
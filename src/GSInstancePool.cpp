@@ -0,0 +1,451 @@
+//
+// GSInstancePool.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSInstancePool.h"
+
+#include "Poco/Path.h"
+#include "Poco/Environment.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+#include "iapi.h"
+#include "ierrors.h"
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+namespace
+{
+	// where the device writes between jobs; closing the job's real
+	// output file is what flushes and finalizes it
+	const std::string NULL_OUTPUT = "/dev/null";
+	const std::string STDOUT_OUTPUT = "-";
+
+	int GSDLLCALL gsStdout(void* handle, const char* str, int len)
+	{
+		return static_cast<GSInstance*>(handle)->writeStdout(str, len);
+	}
+
+	int GSDLLCALL gsPoll(void* handle)
+	{
+		return static_cast<GSInstance*>(handle)->poll();
+	}
+
+	int GSDLLCALL countPoll(void* handle)
+	{
+		++*static_cast<int*>(handle);
+		return 0;
+	}
+
+	bool probePoll()
+	{
+		void* minst = NULL;
+		if (gsapi_new_instance(&minst, NULL) < 0)
+			return false;
+
+		// the interpreter loop polls every few thousand operators, if at all
+		int polls = 0;
+		const char* argv[] = { "", "-q", "-dNODISPLAY", "-dSAFER", "-dNOPAUSE" };
+		gsapi_set_poll_with_handle(minst, countPoll, &polls);
+		int code = gsapi_set_arg_encoding(minst, GS_ARG_ENCODING_UTF8);
+		if (code == 0)
+			code = gsapi_init_with_args(minst, 5, const_cast<char**>(argv));
+		if (code == 0)
+		{
+			int exitCode = 0;
+			gsapi_run_string(minst, "0 1 1000000 { pop } for", 0, &exitCode);
+		}
+		gsapi_exit(minst);
+		gsapi_delete_instance(minst);
+		return polls > 0;
+	}
+}
+
+
+//
+// GSRenderControl
+//
+
+GSRenderControl::GSRenderControl(const std::atomic<bool>& cancelled, const std::atomic<bool>& stopped,
+		Poco::Timestamp::TimeVal deadline) :
+	_cancelled(cancelled),
+	_stopped(stopped),
+	_deadline(deadline)
+{
+}
+
+int GSRenderControl::check()
+{
+	if (_reason.load(std::memory_order_relaxed) != RUNNING)
+		return -1;
+
+	Reason reason = RUNNING;
+	if (_cancelled.load(std::memory_order_relaxed))
+		reason = CANCELLED;
+	else if (_stopped.load(std::memory_order_relaxed))
+		reason = STOPPED;
+	else if (_deadline && Poco::Timestamp().epochMicroseconds() > _deadline)
+		reason = TIMED_OUT;
+	if (reason == RUNNING)
+		return 0;
+
+	// the first reason found sticks, shards polling at the same time agree on it
+	int running = RUNNING;
+	_reason.compare_exchange_strong(running, reason);
+	return -1;
+}
+
+bool GSRenderControl::interruptible()
+{
+	static const bool polled = probePoll();
+	return polled;
+}
+
+
+//
+// GSInstance
+//
+
+GSInstance::GSInstance(const std::string& key, Poco::Logger& logger) :
+	_key(key),
+	_logger(logger)
+{
+}
+
+GSInstance::~GSInstance()
+{
+	if (_initialized)
+		gsapi_exit(_minst);
+	if (_minst)
+	{
+		gsapi_delete_instance(_minst);
+		if (_logger.trace())
+			_logger.trace("Deleted gs instance after %d job(s).", _jobs);
+	}
+}
+
+bool GSInstance::init(const std::string& device, const std::vector<std::string>& gsArgs, const std::string& filesDir)
+{
+	std::vector<std::string> args;
+	args.reserve(gsArgs.size() + 3);
+	bool noPause = false;
+	for (const auto& a : gsArgs)
+	{
+		// BATCH would end the interpreter after init; jobs are run one by one instead
+		if (a == "-dBATCH")
+			continue;
+		if (a == "-dNOPAUSE")
+			noPause = true;
+		args.push_back(a);
+	}
+	if (!noPause)
+		args.push_back("-dNOPAUSE");
+	args.push_back("-sDEVICE=" + device);
+	args.push_back("-sOutputFile=" + NULL_OUTPUT);
+
+	std::vector<const char*> argv;
+	argv.reserve(args.size() + 1);
+	argv.push_back("");
+	for (auto& s : args)
+		argv.push_back(s.c_str());
+
+	int code = gsapi_new_instance(&_minst, NULL);
+	if (code < 0)
+	{
+		_logger.error("gs_new_instance error=%d", code);
+		_minst = nullptr;
+		return false;
+	}
+	else if (_logger.trace())
+		_logger.trace("Created gs instance [%s].", _key);
+
+	// with -dSAFER only files named on the command line are accessible,
+	// so the spool directory has to be permitted for the jobs run later
+	const std::string spool = Poco::Path(Poco::Path::forDirectory(filesDir)).toString() + "*";
+	gsapi_add_control_path(_minst, GS_PERMIT_FILE_READING, spool.c_str());
+	gsapi_add_control_path(_minst, GS_PERMIT_FILE_WRITING, spool.c_str());
+	gsapi_add_control_path(_minst, GS_PERMIT_FILE_WRITING, NULL_OUTPUT.c_str());
+
+	// stdin and stderr stay on the real stdio
+	code = gsapi_set_stdio_with_handle(_minst, NULL, gsStdout, NULL, this);
+	if (code != 0)
+	{
+		_logger.error("gsapi_set_stdio error=%d", code);
+		return false;
+	}
+
+	code = gsapi_set_poll_with_handle(_minst, gsPoll, this);
+	if (code != 0)
+	{
+		_logger.error("gsapi_set_poll error=%d", code);
+		return false;
+	}
+
+	code = gsapi_set_arg_encoding(_minst, GS_ARG_ENCODING_UTF8);
+	if (code != 0)
+	{
+		_logger.error("gsapi_set_arg_encoding error=%d", code);
+		return false;
+	}
+
+	code = gsapi_init_with_args(_minst, static_cast<int>(argv.size()), const_cast<char**>(argv.data()));
+	_initialized = true;
+	if (code != 0)
+	{
+		_logger.error("gsapi_init_with_args error=%d", code);
+		return false;
+	}
+	return true;
+}
+
+bool GSInstance::run(const std::string& inputPath, const std::string& outputPath, GSOutputSink* pSink,
+	const GSRenderParams* pParams, GSRenderControl* pControl, int firstPage, int lastPage)
+{
+	if (pParams && pParams->set && !setRenderParams(*pParams))
+		return false;
+	if (firstPage > 0 && !setPageRange(firstPage, lastPage))
+		return false;
+
+	_pControl = pControl;
+	_pSink = pSink;
+	if (!setOutputFile(pSink ? STDOUT_OUTPUT : outputPath))
+	{
+		_pSink = nullptr;
+		return false;
+	}
+
+	int exitCode = 0;
+	int code = gsapi_run_file(_minst, inputPath.c_str(), 0, &exitCode);
+	++_jobs;
+
+	bool ok = (code == 0 || code == gs_error_Quit);
+	_pControl = nullptr;
+	const bool aborted = pControl && pControl->reason() != GSRenderControl::RUNNING;
+	if (aborted)
+		ok = false;
+	else if (!ok)
+		_logger.error("gsapi_run_file error=%d, exit code=%d", code, exitCode);
+
+	// after an error, a quit or an abort the interpreter state is unknown, start afresh
+	if (code != 0 || aborted)
+		_broken = true;
+
+	// the device writes its trailer on close, so the sink stays attached until then
+	if (!setOutputFile(NULL_OUTPUT))
+		ok = false;
+	_pSink = nullptr;
+
+	return ok;
+}
+
+int GSInstance::poll()
+{
+	return _pControl ? _pControl->check() : 0;
+}
+
+int GSInstance::writeStdout(const char* data, int length)
+{
+	if (_pSink)
+		return _pSink->write(data, length);
+
+	return static_cast<int>(std::fwrite(data, 1, static_cast<std::size_t>(length), stdout));
+}
+
+bool GSInstance::setOutputFile(const std::string& path)
+{
+	int code = gsapi_set_param(_minst, "OutputFile", path.c_str(), gs_spt_string);
+	if (code < 0)
+	{
+		_logger.error("gsapi_set_param OutputFile=[%s] error=%d", path, code);
+		_broken = true;
+		return false;
+	}
+	return true;
+}
+
+bool GSInstance::setRenderParams(const GSRenderParams& params)
+{
+	// the previous job's values stay on the device, so all of them are set, apart
+	// from a buffer space left alone: it only matters to pages that are banded;
+	// more_to_come batches them into a single put_params on the device
+	int threads = params.threads;
+	int bandHeight = params.bandHeight;
+	long bufferSpace = params.bufferSpace;
+	long maxBitmap = params.maxBitmap;
+	int code = gsapi_set_param(_minst, "NumRenderingThreads", &threads, static_cast<gs_set_param_type>(gs_spt_int | gs_spt_more_to_come));
+	if (code >= 0)
+		code = gsapi_set_param(_minst, "BandHeight", &bandHeight, static_cast<gs_set_param_type>(gs_spt_int | gs_spt_more_to_come));
+	if (code >= 0 && bufferSpace > 0)
+		code = gsapi_set_param(_minst, "BufferSpace", &bufferSpace, static_cast<gs_set_param_type>(gs_spt_long | gs_spt_more_to_come));
+	if (code >= 0)
+		code = gsapi_set_param(_minst, "MaxBitmap", &maxBitmap, gs_spt_long);
+	if (code < 0)
+	{
+		_logger.error("gsapi_set_param NumRenderingThreads=%d BandHeight=%d BufferSpace=%ld MaxBitmap=%ld error=%d", threads, bandHeight, bufferSpace, maxBitmap, code);
+		_broken = true;
+		return false;
+	}
+	return true;
+}
+
+bool GSInstance::setPageRange(int firstPage, int lastPage)
+{
+	int code = gsapi_set_param(_minst, "FirstPage", &firstPage, static_cast<gs_set_param_type>(gs_spt_int | gs_spt_more_to_come));
+	if (code >= 0)
+		code = gsapi_set_param(_minst, "LastPage", &lastPage, gs_spt_int);
+	if (code < 0)
+	{
+		_logger.error("gsapi_set_param FirstPage=%d LastPage=%d error=%d", firstPage, lastPage, code);
+		_broken = true;
+		return false;
+	}
+	return true;
+}
+
+
+//
+// GSInstancePool::Reservation
+//
+
+GSInstancePool::Reservation::Reservation(GSInstancePool& pool, int wanted) :
+	_pool(pool),
+	_count(0)
+{
+	int reserved = _pool._shards.load();
+	do
+	{
+		_count = std::max(0, std::min(wanted, _pool._maxShards - reserved));
+	}
+	while (_count > 0 && !_pool._shards.compare_exchange_weak(reserved, reserved + _count));
+}
+
+GSInstancePool::Reservation::~Reservation()
+{
+	_pool._shards -= _count;
+}
+
+void GSInstancePool::Reservation::keep(int count)
+{
+	const int extra = _count - std::max(0, std::min(count, _count));
+	_pool._shards -= extra;
+	_count -= extra;
+}
+
+
+//
+// GSInstancePool
+//
+
+GSInstancePool::GSInstancePool(LayeredConfiguration& config, Logger& logger) :
+	_enabled(config.getBool("gs.pool.enabled", true)),
+	_maxJobs(config.getInt("gs.pool.maxJobs", 200)),
+	_maxRSS(static_cast<std::size_t>(config.getInt64("gs.pool.maxRSS", 0)) * 1024 * 1024),
+	_maxIdle(static_cast<std::size_t>(config.getInt("gs.pool.maxIdle",
+		config.getInt("workers.count", static_cast<int>(Poco::Environment::processorCount()))))),
+	_maxShards(config.getInt("gs.pool.maxShards", static_cast<int>(Poco::Environment::processorCount()))),
+	_filesDir(config.getString("filesDir")),
+	_logger(logger)
+{
+	if (_enabled)
+		_logger.information("Ghostscript instance pool: max %z idle, recycled after %d job(s).", _maxIdle, _maxJobs);
+}
+
+GSInstancePool::~GSInstancePool()
+{
+}
+
+GSInstance::Ptr GSInstancePool::acquire(const std::string& device, const std::vector<std::string>& gsArgs)
+{
+	const std::string key = makeKey(device, gsArgs);
+	{
+		FastMutex::ScopedLock lock(_mutex);
+		for (auto it = _idle.rbegin(); it != _idle.rend(); ++it)
+		{
+			if ((*it)->key() == key)
+			{
+				GSInstance::Ptr pInstance = std::move(*it);
+				_idle.erase(std::next(it).base());
+				return pInstance;
+			}
+		}
+	}
+
+	GSInstance::Ptr pInstance(new GSInstance(key, _logger));
+	if (!pInstance->init(device, gsArgs, _filesDir))
+		return GSInstance::Ptr();
+	return pInstance;
+}
+
+void GSInstancePool::release(GSInstance::Ptr pInstance)
+{
+	if (!_enabled || !pInstance || pInstance->broken())
+		return;
+
+	if (_maxJobs > 0 && pInstance->jobs() >= _maxJobs)
+	{
+		_logger.debug("Recycling gs instance after %d job(s).", pInstance->jobs());
+		return;
+	}
+
+	if (_maxRSS > 0 && residentBytes() > _maxRSS)
+	{
+		_logger.warning("Process RSS above gs.pool.maxRSS, recycling gs instance after %d job(s).", pInstance->jobs());
+		return;
+	}
+
+	// evicted instances are shut down outside the lock
+	GSInstance::Ptr pEvicted;
+	{
+		FastMutex::ScopedLock lock(_mutex);
+		_idle.push_back(std::move(pInstance));
+		if (_idle.size() > _maxIdle)
+		{
+			pEvicted = std::move(_idle.front());
+			_idle.pop_front();
+		}
+	}
+}
+
+std::string GSInstancePool::makeKey(const std::string& device, const std::vector<std::string>& gsArgs)
+{
+	std::string key(device);
+	for (const auto& a : gsArgs)
+	{
+		key += ' ';
+		key += a;
+	}
+	return key;
+}
+
+std::size_t GSInstancePool::residentBytes()
+{
+	std::size_t size = 0, resident = 0;
+	std::ifstream statm("/proc/self/statm");
+	if (statm >> size >> resident)
+		return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	return 0;
+}
@@ -0,0 +1,219 @@
+//
+// GSInstancePool.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSInstancePool_INCLUDED
+#define GSInstancePool_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSRenderTuning.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+class GSOutputSink
+	/// Receives device output written to stdout (-sOutputFile=-),
+	/// e.g. to stream it to printers while later pages still render.
+{
+public:
+	virtual ~GSOutputSink() = default;
+
+	virtual int write(const char* data, int length) = 0;
+		/// Returns the number of bytes consumed, or a negative
+		/// value to make Ghostscript abort the job.
+};
+
+
+class GSRenderControl
+	/// Stops a running conversion from outside. Ghostscript polls it while
+	/// interpreting, and the job is abandoned at the next poll once it is
+	/// cancelled, past its deadline, or the worker is shutting down.
+	/// One control may be polled by several shard instances at once.
+	///
+	/// Only a libgs built with CHECK_INTERRUPTS polls at all (see iapi.h);
+	/// with any other a conversion runs to its end whatever the control says.
+{
+public:
+	enum Reason
+	{
+		RUNNING,
+		CANCELLED,
+		TIMED_OUT,
+		STOPPED
+	};
+
+	GSRenderControl(const std::atomic<bool>& cancelled, const std::atomic<bool>& stopped,
+		Poco::Timestamp::TimeVal deadline = 0);
+
+	int check();
+		/// The poll callback's answer: 0 to go on, negative to abort.
+
+	Reason reason() const { return static_cast<Reason>(_reason.load()); }
+
+	static bool interruptible();
+		/// Whether the linked libgs calls the poll callback. Probed once,
+		/// by counting the polls of a short loop in a scratch interpreter.
+
+private:
+	const std::atomic<bool>& _cancelled;
+	const std::atomic<bool>& _stopped;
+	Poco::Timestamp::TimeVal _deadline;		// 0: none
+	std::atomic<int> _reason{RUNNING};
+};
+
+
+class GSInstance
+	/// A Ghostscript interpreter initialized once with a device and the
+	/// job-independent switches, then fed one job at a time through
+	/// gsapi_run_file. Only the OutputFile device parameter changes per job.
+	/// Not thread safe; a worker owns an instance between acquire and release.
+{
+public:
+	using Ptr = std::unique_ptr<GSInstance>;
+
+	GSInstance(const std::string& key, Poco::Logger& logger);
+	GSInstance(const GSInstance&) = delete;
+	GSInstance& operator=(const GSInstance&) = delete;
+
+	~GSInstance();
+
+	bool init(const std::string& device, const std::vector<std::string>& gsArgs, const std::string& filesDir);
+		/// Creates the interpreter and opens the device. Returns false on any gsapi error.
+
+	bool run(const std::string& inputPath, const std::string& outputPath, GSOutputSink* pSink = nullptr,
+		const GSRenderParams* pParams = nullptr, GSRenderControl* pControl = nullptr, int firstPage = 0, int lastPage = 0);
+		/// Renders inputPath into outputPath. The output file is closed (and
+		/// thereby complete) when this returns. On failure the instance is
+		/// marked broken and must not be reused.
+		///
+		/// With a sink the output goes to stdout and is handed to the sink
+		/// as the device produces it; outputPath is ignored.
+		///
+		/// Render params are device parameters set before the job, like the
+		/// OutputFile, so they do not split the pool into more keys.
+		///
+		/// An aborted run (see GSRenderControl) leaves the instance broken.
+		///
+		/// A page range renders only those pages, through the FirstPage and
+		/// LastPage device parameters (Ghostscript 9.53 or newer). Instances
+		/// used with ranges must have been initialized with -dFirstPage, so
+		/// the page filter is in place and they are pooled apart.
+
+	int writeStdout(const char* data, int length);
+		/// Ghostscript stdout callback target.
+
+	int poll();
+		/// Ghostscript poll callback target.
+
+	const std::string& key() const { return _key; }
+	int jobs() const { return _jobs; }
+	bool broken() const { return _broken; }
+
+private:
+	bool setOutputFile(const std::string& path);
+	bool setRenderParams(const GSRenderParams& params);
+	bool setPageRange(int firstPage, int lastPage);
+
+	std::string _key;
+	Poco::Logger& _logger;
+	void* _minst = nullptr;
+	GSOutputSink* _pSink = nullptr;
+	GSRenderControl* _pControl = nullptr;
+	bool _initialized = false;
+	bool _broken = false;
+	int _jobs = 0;
+};
+
+
+class GSInstancePool
+	/// Keeps idle, pre-initialized Ghostscript instances keyed by device
+	/// and fixed switches, so a job only pays for rendering, not for
+	/// interpreter startup, init files and font setup.
+	///
+	/// Instances are recycled after gs.pool.maxJobs jobs, or when the process
+	/// RSS exceeds gs.pool.maxRSS megabytes, to bound leaks.
+{
+public:
+	class Reservation
+		/// Instances for the shards of one job beyond the worker's own,
+		/// held while in scope. Shards of all workers together never run
+		/// on more than gs.pool.maxShards extra instances.
+	{
+	public:
+		Reservation(GSInstancePool& pool, int wanted);
+			/// Takes as many of the wanted instances as are free, possibly none.
+
+		~Reservation();
+
+		Reservation(const Reservation&) = delete;
+		Reservation& operator=(const Reservation&) = delete;
+
+		int count() const { return _count; }
+
+		void keep(int count);
+			/// Gives back all but count of the reserved instances.
+
+	private:
+		GSInstancePool& _pool;
+		int _count;
+	};
+
+	GSInstancePool(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSInstancePool(const GSInstancePool&) = delete;
+	GSInstancePool& operator=(const GSInstancePool&) = delete;
+
+	~GSInstancePool();
+
+	bool enabled() const { return _enabled; }
+
+	GSInstance::Ptr acquire(const std::string& device, const std::vector<std::string>& gsArgs);
+		/// Returns an idle instance for the key, or a freshly initialized one.
+		/// Returns an empty pointer if Ghostscript could not be initialized.
+
+	void release(GSInstance::Ptr pInstance);
+		/// Returns the instance to the pool, or deletes it if it is broken,
+		/// worn out, the pool is full or disabled.
+
+	static std::string makeKey(const std::string& device, const std::vector<std::string>& gsArgs);
+
+private:
+	static std::size_t residentBytes();
+
+	bool _enabled;
+	int _maxJobs;
+	std::size_t _maxRSS;
+	std::size_t _maxIdle;
+	int _maxShards;
+	std::atomic<int> _shards{0};	// extra instances reserved for shards
+	std::string _filesDir;
+	Poco::Logger& _logger;
+	std::deque<GSInstance::Ptr> _idle;	// most recently released at the back
+	Poco::FastMutex _mutex;
+};
+
+
+#endif // GSInstancePool_INCLUDED
@@ -0,0 +1,136 @@
+//
+// GSJobTable.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSJobTable.h"
+
+#include "Poco/UUIDGenerator.h"
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+GSJobTable::GSJobTable(LayeredConfiguration& config) :
+	_capacity(static_cast<std::size_t>(config.getInt("jobs.history", 10000)))
+{
+	if (_capacity < 1)
+		_capacity = 1;
+	_jobs.reserve(_capacity);
+}
+
+GSJobTable::~GSJobTable()
+{
+}
+
+std::string GSJobTable::add(const JobPtr& job)
+{
+	if (job->jobId.empty())
+		job->jobId = Poco::UUIDGenerator::defaultGenerator().createRandom().toString();
+
+	FastMutex::ScopedLock lock(_mutex);
+	while (_order.size() >= _capacity)
+	{
+		auto it = _jobs.find(_order.front());
+		if (it != _jobs.end())
+		{
+			auto k = _keys.find(it->second->dedupKey);
+			if (k != _keys.end() && k->second == it->second)
+			{
+				_uploading.erase(k->first);
+				_keys.erase(k);
+			}
+			_jobs.erase(it);
+		}
+		_order.pop_front();
+	}
+	_jobs[job->jobId] = job;
+	_order.push_back(job->jobId);
+	return job->jobId;
+}
+
+JobPtr GSJobTable::find(const std::string& jobId) const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	auto it = _jobs.find(jobId);
+	return it == _jobs.end() ? JobPtr() : it->second;
+}
+
+JobPtr GSJobTable::join(const std::string& key, const JobPtr& job, bool keepFinished, bool uploading)
+{
+	FastMutex::ScopedLock lock(_mutex);
+	JobPtr original = live(key, keepFinished);
+	if (original && original != job)
+		return original;
+	job->dedupKey = key;
+	_keys[key] = job;
+	if (uploading)
+		_uploading.insert(key);
+	else
+		_uploading.erase(key);
+	return JobPtr();
+}
+
+JobPtr GSJobTable::holder(const std::string& key, bool keepFinished) const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return live(key, keepFinished);
+}
+
+JobPtr GSJobTable::live(const std::string& key, bool keepFinished) const
+{
+	auto it = _keys.find(key);
+	if (it == _keys.end() || _uploading.count(key) != 0)
+		return JobPtr();
+
+	JobState state;
+	{
+		FastMutex::ScopedLock statusLock(it->second->statusMutex);
+		state = it->second->state;
+	}
+	if (state == JOB_FAILED || state == JOB_CANCELLED || (!keepFinished && state == JOB_DONE))
+		return JobPtr();
+	return it->second;
+}
+
+JobPtr GSJobTable::uploaded(const std::string& key, const JobPtr& job)
+{
+	FastMutex::ScopedLock lock(_mutex);
+	auto it = _keys.find(key);
+	if (it == _keys.end())
+		return JobPtr();
+	if (it->second != job)
+		return it->second;
+	_uploading.erase(key);
+	return JobPtr();
+}
+
+void GSJobTable::remove(const std::string& jobId)
+{
+	// the ID stays in the order until it is the oldest, erasing it then is a no-op
+	FastMutex::ScopedLock lock(_mutex);
+	_jobs.erase(jobId);
+}
+
+std::size_t GSJobTable::size() const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _jobs.size();
+}
@@ -0,0 +1,93 @@
+//
+// GSJobTable.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSJobTable_INCLUDED
+#define GSJobTable_INCLUDED
+
+
+#include "Poco/Mutex.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+
+class GSJobTable
+	/// Bounded in-memory table of recent jobs by ID. The jobs themselves
+	/// carry their state; the table only keeps them reachable for status
+	/// lookups, dropping the oldest once jobs.history entries are held.
+	///
+	/// Jobs can also be registered under a deduplication key, so a repeated
+	/// request joins the job already running instead of starting another.
+{
+public:
+	explicit GSJobTable(Poco::Util::LayeredConfiguration& config);
+	GSJobTable(const GSJobTable&) = delete;
+	GSJobTable& operator=(const GSJobTable&) = delete;
+
+	~GSJobTable();
+
+	std::string add(const JobPtr& job);
+		/// Assigns the job a new ID unless it has one (recovered from the
+		/// journal), registers it and returns the ID.
+
+	JobPtr find(const std::string& jobId) const;
+		/// Returns an empty pointer for unknown or expired IDs.
+
+	JobPtr join(const std::string& key, const JobPtr& job, bool keepFinished, bool uploading = false);
+		/// Returns the job holding the key while it is still in flight (with
+		/// keepFinished also once it is done, but never after it failed or was
+		/// cancelled). Otherwise the given job becomes the holder and an empty
+		/// pointer is returned. A key is forgotten with its holder's entry.
+		///
+		/// A job registered before its upload (uploading) holds the key only
+		/// weakly until uploaded(): the upload may still fail, so a retry
+		/// takes the key over instead of joining it.
+
+	JobPtr holder(const std::string& key, bool keepFinished) const;
+		/// The job join() would return, without registering anything.
+
+	JobPtr uploaded(const std::string& key, const JobPtr& job);
+		/// Ends the upload of a job registered as uploading. Returns the
+		/// job that took the key over meanwhile, if any; otherwise the key
+		/// stays with the given job and later requests join it.
+
+	void remove(const std::string& jobId);
+		/// Drops a job that turned out to be a duplicate.
+
+	std::size_t size() const;
+
+private:
+	JobPtr live(const std::string& key, bool keepFinished) const;
+		/// The holder of the key, if it still counts; the caller holds _mutex.
+
+	std::size_t _capacity;
+	std::unordered_map<std::string, JobPtr> _jobs;
+	std::unordered_map<std::string, JobPtr> _keys;	// deduplication key to holder
+	std::unordered_set<std::string> _uploading;		// keys whose holder is still uploading
+	std::deque<std::string> _order;		// oldest first
+	mutable Poco::FastMutex _mutex;
+};
+
+
+#endif // GSJobTable_INCLUDED
@@ -0,0 +1,615 @@
+//
+// GSJournal.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSJournal.h"
+#include "GSScheduler.h"
+#include "GSJobTable.h"
+#include "GSAdmission.h"
+
+#include "Poco/Checksum.h"
+#include "Poco/DirectoryIterator.h"
+#include "Poco/Error.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Path.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/URI.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+namespace
+{
+	const std::string SEGMENT_PREFIX = "segment-";
+	const std::string SEGMENT_EXTENSION = "log";
+
+	// characters with a meaning in records and payloads
+	const std::string RESERVED = "&=+%";
+
+	void addField(std::string& payload, const std::string& key, const std::string& value)
+	{
+		if (!payload.empty())
+			payload += '&';
+		payload += key;
+		payload += '=';
+		Poco::URI::encode(value, RESERVED, payload);
+	}
+
+	std::vector<std::pair<std::string, std::string>> fields(const std::string& payload)
+	{
+		std::vector<std::pair<std::string, std::string>> result;
+		Poco::StringTokenizer tok(payload, "&", Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+		for (const auto& f : tok)
+		{
+			const std::string::size_type eq = f.find('=');
+			std::string value;
+			Poco::URI::decode(eq == std::string::npos ? std::string() : f.substr(eq + 1), value);
+			result.emplace_back(f.substr(0, eq), value);
+		}
+		return result;
+	}
+
+	std::string field(const std::string& payload, const std::string& key)
+	{
+		for (const auto& f : fields(payload))
+		{
+			if (f.first == key)
+				return f.second;
+		}
+		return std::string();
+	}
+
+	void writeAll(int fd, const std::string& data)
+	{
+		std::size_t written = 0;
+		while (written < data.size())
+		{
+			ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				throw Poco::WriteFileException("journal", errno);
+			}
+			written += static_cast<std::size_t>(n);
+		}
+	}
+
+	void syncDirectory(const std::string& dir)
+	{
+		int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			::fsync(fd);
+			::close(fd);
+		}
+	}
+}
+
+
+GSJournal::GSJournal(LayeredConfiguration& config, Logger& logger) :
+	_enabled(config.getBool("journal.enabled", false)),
+	_syncInterval(0, std::max(1, config.getInt("journal.syncInterval", 50)) * 1000),
+	_maxSegmentBytes(static_cast<Poco::UInt64>(config.getInt64("journal.segmentBytes", 16 * 1024 * 1024))),
+	_logger(logger),
+	_compactAt(_maxSegmentBytes)
+{
+	if (!_enabled)
+		return;
+
+	Poco::Path dir(Poco::Path::forDirectory(config.getString("filesDir")));
+	dir.pushDirectory("journal");
+	_dir = Poco::Path::forDirectory(config.getString("journal.dir", dir.toString())).toString();
+	Poco::File(_dir).createDirectories();
+}
+
+GSJournal::~GSJournal()
+{
+	if (_thread.isRunning())
+	{
+		{
+			FastMutex::ScopedLock lock(_mutex);
+			_stop = true;
+			_wake.signal();
+		}
+		_thread.join();
+	}
+	if (_fd >= 0)
+		::close(_fd);
+}
+
+std::size_t GSJournal::recover(GSScheduler& scheduler, Poco::NotificationQueue& sendQ, GSJobTable& jobs, GSAdmission& admission)
+{
+	if (!_enabled)
+		return 0;
+
+	struct State
+	{
+		JobPtr job;
+		bool converted;
+		Poco::UInt64 seq;
+	};
+	std::unordered_map<std::string, State> states;
+	std::size_t records = 0;
+	std::size_t torn = 0;
+
+	const std::vector<Poco::UInt64> numbers = segments();
+	for (Poco::UInt64 n : numbers)
+	{
+		std::ifstream in(segmentPath(n), std::ios::binary);
+		std::string line;
+		while (std::getline(in, line))
+		{
+			char type;
+			std::string jobId, payload;
+			// a crash may leave a partly written last record
+			if (!decodeRecord(line, type, jobId, payload))
+			{
+				++torn;
+				continue;
+			}
+			++records;
+			line += '\n';
+
+			if (type == 'Q')
+			{
+				JobPtr job = decodeJob(payload);
+				if (!job)
+					continue;
+				job->jobId = jobId;
+				_live[jobId] = Live{++_seq, {line}};
+				states[jobId] = State{job, false, _seq};
+				continue;
+			}
+
+			auto it = states.find(jobId);
+			if (it == states.end())
+				continue;
+			if (type == 'D')
+			{
+				states.erase(it);
+				_live.erase(jobId);
+				continue;
+			}
+			Job& job = *it->second.job;
+			if (type == 'C')
+			{
+				const std::string output = field(payload, "out");
+				if (!output.empty())
+					job.outputPath = output;
+				it->second.converted = true;
+			}
+			else if (type == 'S')
+			{
+				auto p = std::find(job.printers.begin(), job.printers.end(), field(payload, "prn"));
+				if (p != job.printers.end())
+					job.printers.erase(p);
+			}
+			_live[jobId].records.push_back(line);
+		}
+	}
+
+	// start on a fresh segment holding only what is still live
+	_segment = numbers.empty() ? 0 : numbers.back();
+	compact();
+	_thread.startFunc([this]() { run(); });
+
+	std::vector<State> pending;
+	pending.reserve(states.size());
+	for (auto& s : states)
+		pending.push_back(s.second);
+	std::sort(pending.begin(), pending.end(), [](const State& a, const State& b) { return a.seq < b.seq; });
+
+	std::size_t recovered = 0;
+	for (auto& s : pending)
+	{
+		JobPtr job = s.job;
+		jobs.add(job);
+		const std::string& file = s.converted ? job->outputPath : job->inputPath;
+		if (s.converted && job->printers.empty())
+		{
+			job->setState(JOB_DONE);
+			done(*job);
+			continue;
+		}
+		if (!Poco::File(file).exists())
+		{
+			_logger.warning("Journal: [%s] of job %s is gone, dropping the job.", file, job->jobId);
+			job->setState(JOB_FAILED);
+			done(*job);
+			continue;
+		}
+
+		if (s.converted)
+		{
+			job->setState(JOB_CONVERTED);
+			sendQ.enqueueNotification(new JobNotification(job));
+		}
+		else
+		{
+			admission.admit(*job, Poco::File(file).getSize(), true);
+			job->setState(JOB_QUEUED);
+			scheduler.enqueue(job);
+		}
+		++recovered;
+	}
+
+	_logger.information("Journal [%s]: %z record(s) replayed from %z segment(s), %z job(s) recovered.",
+		_dir, records, numbers.size(), recovered);
+	if (torn)
+		_logger.warning("Journal: skipped %z damaged record(s).", torn);
+	return recovered;
+}
+
+bool GSJournal::queued(const Job& job)
+{
+	return append(job.jobId, 'Q', encodeJob(job), true);
+}
+
+void GSJournal::converted(const Job& job)
+{
+	std::string payload;
+	addField(payload, "out", job.outputPath);
+	append(job.jobId, 'C', payload, false);
+}
+
+void GSJournal::sent(const Job& job, std::size_t index)
+{
+	std::string payload;
+	addField(payload, "prn", job.printers[index]);
+	append(job.jobId, 'S', payload, false);
+}
+
+void GSJournal::done(const Job& job)
+{
+	append(job.jobId, 'D', std::string(), false);
+}
+
+bool GSJournal::append(const std::string& jobId, char type, const std::string& payload, bool wait)
+{
+	if (!_enabled || jobId.empty())
+		return true;
+
+	const std::string line = encodeRecord(type, jobId, payload);
+
+	FastMutex::ScopedLock lock(_mutex);
+	if (type == 'Q')
+		_live[jobId] = Live{++_seq, {line}};
+	else
+	{
+		// transitions of jobs that were never journaled are of no use
+		auto it = _live.find(jobId);
+		if (it == _live.end())
+			return true;
+		if (type == 'D')
+			_live.erase(it);
+		else
+			it->second.records.push_back(line);
+	}
+	_pending += line;
+	const Poco::UInt64 mine = ++_appended;
+
+	if (!wait)
+		return true;
+
+	_waiting.push_back(jobId);
+	_wake.signal();
+	while (_synced < mine && _thread.isRunning())
+		_durable.tryWait(_mutex, 1000);
+	return _synced >= mine && _lost.erase(jobId) == 0;
+}
+
+void GSJournal::run()
+{
+	for (;;)
+	{
+		{
+			FastMutex::ScopedLock lock(_mutex);
+			if (_pending.empty() && !_stop)
+				_wake.tryWait(_mutex, static_cast<long>(_syncInterval.totalMilliseconds()));
+			if (_pending.empty())
+			{
+				if (_stop)
+					break;
+				continue;
+			}
+		}
+
+		// the live records already include everything pending
+		if (_segmentBytes >= _compactAt && compact())
+			continue;
+
+		std::string data;
+		std::vector<std::string> waiting;
+		Poco::UInt64 target = 0;
+		{
+			FastMutex::ScopedLock lock(_mutex);
+			target = _appended;
+			data.swap(_pending);
+			waiting.swap(_waiting);
+		}
+
+		// appenders go on filling _pending while this batch is synced
+		try
+		{
+			writeAll(_fd, data);
+			if (::fdatasync(_fd) != 0)
+				throw Poco::WriteFileException(segmentPath(_segment), errno);
+			_segmentBytes += data.size();
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.error("Journal write failed, refusing %z queued job(s): %s", waiting.size(), ex.displayText());
+			{
+				FastMutex::ScopedLock lock(_mutex);
+				for (const auto& jobId : waiting)
+				{
+					_live.erase(jobId);
+					_lost.insert(jobId);
+				}
+			}
+			// a partly written batch must not sit in front of the next one; the
+			// batch's other records are still live and rewritten by the compaction
+			if (::ftruncate(_fd, static_cast<off_t>(_segmentBytes)) != 0)
+				_logger.error("Journal truncation failed: %s", Poco::Error::getMessage(errno));
+			compact();
+		}
+
+		FastMutex::ScopedLock lock(_mutex);
+		if (_synced < target)
+			_synced = target;
+		_durable.broadcast();
+	}
+}
+
+bool GSJournal::compact()
+	/// Runs on the writer thread, or before it starts. Only the snapshot
+	/// and the switch to the new segment hold the mutex, never the I/O.
+{
+	std::string data;
+	std::size_t pending;
+	std::size_t waiting;
+	Poco::UInt64 target;
+	{
+		FastMutex::ScopedLock lock(_mutex);
+		for (const auto& r : snapshot())
+			data += r;
+		pending = _pending.size();
+		waiting = _waiting.size();
+		target = _appended;
+	}
+
+	const Poco::UInt64 next = _segment + 1;
+	const std::string path = segmentPath(next);
+	const std::string tmp = path + ".tmp";
+	try
+	{
+		int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			throw Poco::CreateFileException(tmp, errno);
+		try
+		{
+			writeAll(fd, data);
+			if (::fdatasync(fd) != 0)
+				throw Poco::WriteFileException(tmp, errno);
+		}
+		catch (...)
+		{
+			::close(fd);
+			throw;
+		}
+		::close(fd);
+		Poco::File(tmp).renameTo(path);
+		syncDirectory(_dir);
+
+		if (_fd >= 0)
+			::close(_fd);
+		openSegment(next);
+		for (Poco::UInt64 n : segments())
+		{
+			if (n < next)
+				Poco::File(segmentPath(n)).remove();
+		}
+	}
+	catch (Poco::Exception& ex)
+	{
+		// keep appending to the current segment, nothing is lost; try
+		// again once another segment's worth has been written
+		_logger.error("Journal compaction failed: %s", ex.displayText());
+		if (_fd < 0)
+			openSegment(_segment);
+		_compactAt = _segmentBytes + _maxSegmentBytes;
+		return false;
+	}
+	// a live set larger than a segment must not be compacted on every batch
+	_compactAt = std::max(_maxSegmentBytes, 2 * static_cast<Poco::UInt64>(data.size()));
+
+	// what was pending at the snapshot is in the new segment
+	FastMutex::ScopedLock lock(_mutex);
+	_pending.erase(0, pending);
+	_waiting.erase(_waiting.begin(), _waiting.begin() + static_cast<std::ptrdiff_t>(waiting));
+	if (_synced < target)
+		_synced = target;
+	_durable.broadcast();
+	return true;
+}
+
+std::vector<std::string> GSJournal::snapshot() const
+{
+	std::vector<const Live*> live;
+	live.reserve(_live.size());
+	for (const auto& l : _live)
+		live.push_back(&l.second);
+	std::sort(live.begin(), live.end(), [](const Live* a, const Live* b) { return a->seq < b->seq; });
+
+	std::vector<std::string> records;
+	for (const Live* l : live)
+		records.insert(records.end(), l->records.begin(), l->records.end());
+	return records;
+}
+
+void GSJournal::openSegment(Poco::UInt64 number)
+{
+	const std::string path = segmentPath(number);
+	_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (_fd < 0)
+		throw Poco::OpenFileException(path, errno);
+	_segment = number;
+	_segmentBytes = static_cast<Poco::UInt64>(Poco::File(path).getSize());
+}
+
+std::string GSJournal::segmentPath(Poco::UInt64 number) const
+{
+	return Poco::Path(_dir, SEGMENT_PREFIX + Poco::NumberFormatter::format0(number, 10) + "." + SEGMENT_EXTENSION).toString();
+}
+
+std::vector<Poco::UInt64> GSJournal::segments() const
+{
+	std::vector<Poco::UInt64> numbers;
+	for (Poco::DirectoryIterator it(_dir), end; it != end; ++it)
+	{
+		const std::string name = it.path().getBaseName();
+		Poco::UInt64 n = 0;
+		if (it.path().getExtension() == SEGMENT_EXTENSION && name.compare(0, SEGMENT_PREFIX.size(), SEGMENT_PREFIX) == 0 &&
+			Poco::NumberParser::tryParseUnsigned64(name.substr(SEGMENT_PREFIX.size()), n))
+			numbers.push_back(n);
+	}
+	std::sort(numbers.begin(), numbers.end());
+	return numbers;
+}
+
+std::string GSJournal::encodeRecord(char type, const std::string& jobId, const std::string& payload)
+{
+	std::string body;
+	body += type;
+	body += ' ';
+	body += jobId;
+	body += ' ';
+	body += payload;
+
+	Poco::Checksum crc(Poco::Checksum::TYPE_CRC32);
+	crc.update(body);
+	return Poco::NumberFormatter::formatHex(crc.checksum(), 8) + " " + body + "\n";
+}
+
+bool GSJournal::decodeRecord(const std::string& line, char& type, std::string& jobId, std::string& payload)
+{
+	// "crc32 T jobId payload"
+	if (line.size() < 12 || line[8] != ' ' || line[10] != ' ')
+		return false;
+	unsigned crcValue = 0;
+	if (!Poco::NumberParser::tryParseHex(line.substr(0, 8), crcValue))
+		return false;
+
+	const std::string body = line.substr(9);
+	Poco::Checksum crc(Poco::Checksum::TYPE_CRC32);
+	crc.update(body);
+	if (crc.checksum() != crcValue)
+		return false;
+
+	const std::string::size_type sp = body.find(' ', 2);
+	if (sp == std::string::npos)
+		return false;
+	type = body[0];
+	jobId = body.substr(2, sp - 2);
+	payload = body.substr(sp + 1);
+	return !jobId.empty();
+}
+
+std::string GSJournal::encodeJob(const Job& job)
+{
+	std::string payload;
+	addField(payload, "in", job.inputPath);
+	addField(payload, "out", job.outputPath);
+	addField(payload, "fmt", job.formatLabel);
+	addField(payload, "dev", job.device);
+	for (const auto& a : job.gsArgs)
+		addField(payload, "arg", a);
+	for (const auto& p : job.printers)
+		addField(payload, "prn", p);
+	addField(payload, "pri", Poco::NumberFormatter::format(static_cast<int>(job.priority)));
+	if (job.deadline)
+		addField(payload, "dl", Poco::NumberFormatter::format(job.deadline));
+	if (job.stream)
+		addField(payload, "stream", "1");
+	if (!job.cacheKey.empty())
+		addField(payload, "cache", job.cacheKey);
+	// the preflight does not run again on replay, the memory estimate needs the page size
+	if (job.mediaWidth > 0 && job.mediaHeight > 0)
+	{
+		addField(payload, "mw", Poco::NumberFormatter::format(job.mediaWidth));
+		addField(payload, "mh", Poco::NumberFormatter::format(job.mediaHeight));
+	}
+	return payload;
+}
+
+JobPtr GSJournal::decodeJob(const std::string& payload)
+{
+	auto job = std::make_shared<Job>();
+	for (const auto& f : fields(payload))
+	{
+		if (f.first == "in")
+			job->inputPath = f.second;
+		else if (f.first == "out")
+			job->outputPath = f.second;
+		else if (f.first == "fmt")
+			job->formatLabel = f.second;
+		else if (f.first == "dev")
+			job->device = f.second;
+		else if (f.first == "arg")
+			job->gsArgs.push_back(f.second);
+		else if (f.first == "prn")
+			job->printers.push_back(f.second);
+		else if (f.first == "pri")
+		{
+			int priority = PRIORITY_NORMAL;
+			if (Poco::NumberParser::tryParse(f.second, priority) && priority >= 0 && priority < PRIORITY_COUNT)
+				job->priority = static_cast<JobPriority>(priority);
+		}
+		else if (f.first == "dl")
+		{
+			Poco::Int64 deadline = 0;
+			if (Poco::NumberParser::tryParse64(f.second, deadline))
+				job->deadline = deadline;
+		}
+		else if (f.first == "stream")
+			job->stream = true;
+		else if (f.first == "cache")
+			job->cacheKey = f.second;
+		else if (f.first == "mw")
+			Poco::NumberParser::tryParseFloat(f.second, job->mediaWidth);
+		else if (f.first == "mh")
+			Poco::NumberParser::tryParseFloat(f.second, job->mediaHeight);
+	}
+	if (job->inputPath.empty() || job->outputPath.empty() || job->device.empty())
+		return JobPtr();
+	return job;
+}
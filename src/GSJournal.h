@@ -0,0 +1,138 @@
+//
+// GSJournal.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSJournal_INCLUDED
+#define GSJournal_INCLUDED
+
+
+#include "Poco/Condition.h"
+#include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/NotificationQueue.h"
+#include "Poco/Thread.h"
+#include "Poco/Timespan.h"
+#include "Poco/Types.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+class GSScheduler;
+class GSJobTable;
+class GSAdmission;
+
+
+class GSJournal
+	/// Append-only journal of job transitions, so queued and unsent jobs
+	/// survive a restart or crash:
+	///
+	///   Q  queued for conversion, with everything needed to rebuild the job
+	///   C  converted, with the final output path
+	///   S  delivered to (or given up on) one printer
+	///   D  done, nothing left to recover
+	///
+	/// Records are checksummed lines in segment files under journal.dir
+	/// (default filesDir/journal/). A background thread writes them and
+	/// fdatasyncs in batches: queued() waits for its record to be durable,
+	/// so an accepted upload is never lost; the later transitions do not
+	/// wait and are at most journal.syncInterval ms behind. A batch that
+	/// fails to write is cut off the segment again, its queued jobs are
+	/// refused and the others are rewritten by a compaction.
+	///
+	/// Only records of unfinished jobs are kept in memory. When a segment
+	/// grows past journal.segmentBytes they are written to a fresh segment
+	/// and the old ones are deleted, so the journal, and the time to
+	/// replay it, is bounded by the jobs in flight, not by history. The
+	/// next compaction waits until the segment has grown to twice what
+	/// the last one wrote.
+{
+public:
+	GSJournal(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSJournal(const GSJournal&) = delete;
+	GSJournal& operator=(const GSJournal&) = delete;
+
+	~GSJournal();
+
+	bool enabled() const { return _enabled; }
+
+	std::size_t recover(GSScheduler& scheduler, Poco::NotificationQueue& sendQ, GSJobTable& jobs, GSAdmission& admission);
+		/// Replays the journal and requeues unfinished jobs: unconverted
+		/// ones to the scheduler, converted ones to sendQ for the printers
+		/// not yet delivered to. Must run before the workers and the
+		/// sender start. Returns the number of jobs recovered.
+
+	bool queued(const Job& job);
+		/// Returns once the record is on disk, or false if it could not
+		/// be written; the job must not be accepted then.
+	void converted(const Job& job);
+	void sent(const Job& job, std::size_t index);
+	void done(const Job& job);
+
+private:
+	struct Live
+	{
+		Poco::UInt64 seq;					// order of the Q record
+		std::vector<std::string> records;	// encoded lines
+	};
+
+	bool append(const std::string& jobId, char type, const std::string& payload, bool wait);
+	void run();
+	void openSegment(Poco::UInt64 number);
+	bool compact();
+	std::vector<std::string> snapshot() const;
+	std::string segmentPath(Poco::UInt64 number) const;
+	std::vector<Poco::UInt64> segments() const;
+
+	static std::string encodeRecord(char type, const std::string& jobId, const std::string& payload);
+	static bool decodeRecord(const std::string& line, char& type, std::string& jobId, std::string& payload);
+	static std::string encodeJob(const Job& job);
+	static JobPtr decodeJob(const std::string& payload);
+
+	bool _enabled;
+	std::string _dir;
+	Poco::Timespan _syncInterval;
+	Poco::UInt64 _maxSegmentBytes;
+	Poco::Logger& _logger;
+
+	int _fd = -1;
+	Poco::UInt64 _segment = 0;			// number of the segment written to
+	Poco::UInt64 _segmentBytes = 0;
+	Poco::UInt64 _compactAt;			// segment size that triggers the next compaction
+
+	std::string _pending;				// appended, not yet written
+	std::vector<std::string> _waiting;	// jobs whose queued record in _pending is waited for
+	std::unordered_set<std::string> _lost;	// jobs whose queued record failed to write
+	std::unordered_map<std::string, Live> _live;
+	Poco::UInt64 _seq = 0;
+	Poco::UInt64 _appended = 0;			// records appended ...
+	Poco::UInt64 _synced = 0;			// ... and on disk
+	bool _stop = false;
+	mutable Poco::FastMutex _mutex;
+	Poco::Condition _wake;				// signals the writer
+	Poco::Condition _durable;			// signals waiting appenders
+	Poco::Thread _thread;
+};
+
+
+#endif // GSJournal_INCLUDED
@@ -0,0 +1,88 @@
+//
+// GSMemoryBudget.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSMemoryBudget.h"
+
+#include <algorithm>
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+GSMemoryBudget::GSMemoryBudget(LayeredConfiguration& config, const GSRenderTuning& tuning, Logger& logger) :
+	_tuning(tuning),
+	_budget(static_cast<Poco::UInt64>(config.getInt64("render.memoryBudget", 0)) * 1024 * 1024),
+	_baseMemory(static_cast<Poco::UInt64>(config.getInt64("render.baseMemory", 32)) * 1024 * 1024)
+{
+	if (enabled())
+		logger.information("Raster memory budget: %Lu MB for all running conversions.", _budget / (1024 * 1024));
+}
+
+GSMemoryBudget::~GSMemoryBudget()
+{
+}
+
+Poco::UInt64 GSMemoryBudget::estimate(const Job& job) const
+{
+	return _baseMemory + _tuning.rasterBytes(job);
+}
+
+bool GSMemoryBudget::tryStart(Job& job)
+{
+	if (!enabled())
+		return true;
+
+	const Poco::UInt64 needed = estimate(job);
+	FastMutex::ScopedLock lock(_mutex);
+	if (_used > 0 && _used + needed > _budget)
+		return false;
+	_used += needed;
+	job.memory = needed;
+	return true;
+}
+
+int GSMemoryBudget::widen(Job& job, int instances)
+{
+	if (!enabled() || instances < 2 || job.memory == 0)
+		return instances;
+
+	const Poco::UInt64 each = job.memory;
+	FastMutex::ScopedLock lock(_mutex);
+	const Poco::UInt64 left = _used < _budget ? _budget - _used : 0;
+	const int more = static_cast<int>(std::min<Poco::UInt64>(left / each, static_cast<Poco::UInt64>(instances - 1)));
+	_used += each * more;
+	job.memory += each * more;
+	return 1 + more;
+}
+
+void GSMemoryBudget::release(Job& job)
+{
+	FastMutex::ScopedLock lock(_mutex);
+	_used -= std::min(_used, job.memory);
+	job.memory = 0;
+}
+
+Poco::UInt64 GSMemoryBudget::used() const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _used;
+}
@@ -0,0 +1,78 @@
+//
+// GSMemoryBudget.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSMemoryBudget_INCLUDED
+#define GSMemoryBudget_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include "GSRenderTuning.h"
+#include "GSScheduler.h"
+
+
+class GSMemoryBudget : public GSScheduler::Gate
+	/// Bounds the raster memory of the conversions running at once to
+	/// render.memoryBudget megabytes, across all workers.
+	///
+	/// A job needs render.baseMemory megabytes for the interpreter plus the
+	/// raster memory of its page (see GSRenderTuning::rasterBytes), taken
+	/// from the preflight's media size, the resolution and the device depth;
+	/// a banded page adds a band buffer for every rendering thread.
+	/// A job that does not fit waits in the scheduler while smaller ones go
+	/// ahead. A job larger than the whole budget runs once nothing else does.
+{
+public:
+	GSMemoryBudget(Poco::Util::LayeredConfiguration& config, const GSRenderTuning& tuning, Poco::Logger& logger);
+	GSMemoryBudget(const GSMemoryBudget&) = delete;
+	GSMemoryBudget& operator=(const GSMemoryBudget&) = delete;
+
+	~GSMemoryBudget();
+
+	bool enabled() const { return _budget > 0; }
+
+	Poco::UInt64 estimate(const Job& job) const;
+		/// Memory of one Ghostscript instance converting the job.
+
+	bool tryStart(Job& job) override;
+		/// Reserves the job's estimate, if it fits.
+
+	int widen(Job& job, int instances);
+		/// Reserves more for rendering the job in up to the given number
+		/// of instances, and returns how many the budget allows (at least 1).
+
+	void release(Job& job);
+		/// Gives the job's reservation back. Safe to call more than once.
+
+	Poco::UInt64 used() const;
+
+private:
+	const GSRenderTuning& _tuning;
+	Poco::UInt64 _budget;		// bytes, 0: unlimited
+	Poco::UInt64 _baseMemory;	// bytes per instance
+	Poco::UInt64 _used = 0;
+	mutable Poco::FastMutex _mutex;
+};
+
+
+#endif // GSMemoryBudget_INCLUDED
@@ -0,0 +1,243 @@
+//
+// GSMetrics.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSMetrics.h"
+#include "GSPresets.h"
+
+#include "Poco/SingletonHolder.h"
+
+
+namespace
+{
+	const std::vector<double> SECONDS_BUCKETS = { 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300 };
+	const std::vector<double> BYTES_BUCKETS = { 16e3, 64e3, 256e3, 1e6, 4e6, 16e6, 64e6, 256e6, 1e9 };
+	const std::vector<double> RATE_BUCKETS = { 16e3, 64e3, 256e3, 1e6, 4e6, 16e6, 64e6, 256e6 };
+
+	std::vector<std::string> metricDevices()
+	{
+		// unknown devices are counted together
+		std::vector<std::string> devices(GSPresets::devices());
+		devices.push_back("other");
+		return devices;
+	}
+}
+
+
+//
+// GSHistogram
+//
+
+GSHistogram::GSHistogram(const std::vector<double>& bounds) :
+	_bounds(bounds),
+	_buckets(new std::atomic<Poco::UInt64>[bounds.size() + 1])
+{
+	for (std::size_t i = 0; i <= _bounds.size(); ++i)
+		_buckets[i] = 0;
+}
+
+void GSHistogram::observe(double value)
+{
+	std::size_t i = 0;
+	while (i < _bounds.size() && value > _bounds[i])
+		++i;
+	_buckets[i].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+
+	double sum = _sum.load(std::memory_order_relaxed);
+	while (!_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+		;
+}
+
+void GSHistogram::write(std::ostream& os, const std::string& name, const std::string& labels) const
+{
+	const std::string sep = labels.empty() ? "" : ",";
+	Poco::UInt64 cumulative = 0;
+	for (std::size_t i = 0; i <= _bounds.size(); ++i)
+	{
+		cumulative += _buckets[i].load(std::memory_order_relaxed);
+		os << name << "_bucket{" << labels << sep << "le=\"";
+		if (i < _bounds.size())
+			os << _bounds[i];
+		else
+			os << "+Inf";
+		os << "\"} " << cumulative << "\n";
+	}
+	const std::string braced = labels.empty() ? "" : "{" + labels + "}";
+	// every digit: a sum printed as 1.23457e+09 makes rate() over it stepwise
+	const std::streamsize precision = os.precision(17);
+	os << name << "_sum" << braced << " " << _sum.load(std::memory_order_relaxed) << "\n";
+	os.precision(precision);
+	os << name << "_count" << braced << " " << _count.load(std::memory_order_relaxed) << "\n";
+}
+
+
+//
+// GSMetrics
+//
+
+GSMetrics& GSMetrics::instance()
+{
+	static Poco::SingletonHolder<GSMetrics> sh;
+	return *sh.get();
+}
+
+GSMetrics::GSMetrics() :
+	_devices(metricDevices()),
+	_uploadBytes(BYTES_BUCKETS),
+	_conversionsOk(new std::atomic<Poco::UInt64>[_devices.size()]),
+	_conversionsFailed(new std::atomic<Poco::UInt64>[_devices.size()]),
+	_sendSeconds(SECONDS_BUCKETS),
+	_sendRate(RATE_BUCKETS),
+	_deadlinesMissed(new std::atomic<Poco::UInt64>[PRIORITY_COUNT])
+{
+	for (std::size_t i = 0; i < _devices.size(); ++i)
+	{
+		_conversionsOk[i] = 0;
+		_conversionsFailed[i] = 0;
+		_conversionSeconds.emplace_back(new GSHistogram(SECONDS_BUCKETS));
+	}
+	for (int c = 0; c < PRIORITY_COUNT; ++c)
+	{
+		_deadlinesMissed[c] = 0;
+		_queueWaitSeconds.emplace_back(new GSHistogram(SECONDS_BUCKETS));
+	}
+}
+
+void GSMetrics::upload(Poco::UInt64 bytes)
+{
+	_uploads.fetch_add(1, std::memory_order_relaxed);
+	_uploadBytes.observe(static_cast<double>(bytes));
+}
+
+void GSMetrics::uploadTimeout()
+{
+	_uploadTimeouts.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GSMetrics::preflightRejected()
+{
+	_preflightRejected.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GSMetrics::joined()
+{
+	_joined.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GSMetrics::conversion(const std::string& device, bool ok, double seconds)
+{
+	const std::size_t i = deviceIndex(device);
+	(ok ? _conversionsOk : _conversionsFailed)[i].fetch_add(1, std::memory_order_relaxed);
+	_conversionSeconds[i]->observe(seconds);
+}
+
+void GSMetrics::conversionFailed(const std::string& device)
+{
+	_conversionsFailed[deviceIndex(device)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void GSMetrics::send(Poco::UInt64 bytes, double seconds)
+{
+	_sendsOk.fetch_add(1, std::memory_order_relaxed);
+	_sendBytes.fetch_add(bytes, std::memory_order_relaxed);
+	_sendSeconds.observe(seconds);
+	if (seconds > 0)
+		_sendRate.observe(static_cast<double>(bytes) / seconds);
+}
+
+void GSMetrics::sendFailed()
+{
+	_sendsFailed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GSMetrics::sendRetry()
+{
+	_sendRetries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GSMetrics::queueWait(JobPriority priority, double seconds, bool missedDeadline)
+{
+	_queueWaitSeconds[priority]->observe(seconds);
+	if (missedDeadline)
+		_deadlinesMissed[priority].fetch_add(1, std::memory_order_relaxed);
+}
+
+void GSMetrics::memoryDeferred()
+{
+	_memoryDeferred.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GSMetrics::write(std::ostream& os) const
+{
+	os << "# TYPE gsserver_uploads_total counter\n"
+	   << "gsserver_uploads_total " << _uploads.load() << "\n";
+	os << "# TYPE gsserver_upload_bytes histogram\n";
+	_uploadBytes.write(os, "gsserver_upload_bytes", "");
+	os << "# TYPE gsserver_upload_timeouts_total counter\n"
+	   << "gsserver_upload_timeouts_total " << _uploadTimeouts.load() << "\n";
+	os << "# TYPE gsserver_preflight_rejected_total counter\n"
+	   << "gsserver_preflight_rejected_total " << _preflightRejected.load() << "\n";
+	os << "# TYPE gsserver_jobs_joined_total counter\n"
+	   << "gsserver_jobs_joined_total " << _joined.load() << "\n";
+
+	os << "# TYPE gsserver_conversions_total counter\n";
+	for (std::size_t i = 0; i < _devices.size(); ++i)
+	{
+		os << "gsserver_conversions_total{device=\"" << _devices[i] << "\",result=\"ok\"} " << _conversionsOk[i].load() << "\n";
+		os << "gsserver_conversions_total{device=\"" << _devices[i] << "\",result=\"failed\"} " << _conversionsFailed[i].load() << "\n";
+	}
+	os << "# TYPE gsserver_conversion_seconds histogram\n";
+	for (std::size_t i = 0; i < _devices.size(); ++i)
+		_conversionSeconds[i]->write(os, "gsserver_conversion_seconds", "device=\"" + _devices[i] + "\"");
+
+	os << "# TYPE gsserver_sends_total counter\n"
+	   << "gsserver_sends_total{result=\"ok\"} " << _sendsOk.load() << "\n"
+	   << "gsserver_sends_total{result=\"failed\"} " << _sendsFailed.load() << "\n";
+	os << "# TYPE gsserver_send_retries_total counter\n"
+	   << "gsserver_send_retries_total " << _sendRetries.load() << "\n";
+	os << "# TYPE gsserver_send_bytes_total counter\n"
+	   << "gsserver_send_bytes_total " << _sendBytes.load() << "\n";
+	os << "# TYPE gsserver_send_seconds histogram\n";
+	_sendSeconds.write(os, "gsserver_send_seconds", "");
+	os << "# TYPE gsserver_send_bytes_per_second histogram\n";
+	_sendRate.write(os, "gsserver_send_bytes_per_second", "");
+
+	os << "# TYPE gsserver_queue_wait_seconds histogram\n";
+	for (int c = 0; c < PRIORITY_COUNT; ++c)
+		_queueWaitSeconds[c]->write(os, "gsserver_queue_wait_seconds",
+			std::string("class=\"") + jobPriorityName(static_cast<JobPriority>(c)) + "\"");
+	os << "# TYPE gsserver_deadlines_missed_total counter\n";
+	for (int c = 0; c < PRIORITY_COUNT; ++c)
+		os << "gsserver_deadlines_missed_total{class=\"" << jobPriorityName(static_cast<JobPriority>(c)) << "\"} "
+		   << _deadlinesMissed[c].load() << "\n";
+	os << "# TYPE gsserver_memory_deferred_total counter\n"
+	   << "gsserver_memory_deferred_total " << _memoryDeferred.load() << "\n";
+}
+
+std::size_t GSMetrics::deviceIndex(const std::string& device) const
+{
+	for (std::size_t i = 0; i + 1 < _devices.size(); ++i)
+	{
+		if (_devices[i] == device)
+			return i;
+	}
+	return _devices.size() - 1;
+}
@@ -0,0 +1,112 @@
+//
+// GSMetrics.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSMetrics_INCLUDED
+#define GSMetrics_INCLUDED
+
+
+#include "Poco/Types.h"
+#include "GSNotification.h"
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+class GSHistogram
+	/// Fixed-bucket histogram, safe to observe from any thread without locking.
+{
+public:
+	explicit GSHistogram(const std::vector<double>& bounds);
+	GSHistogram(const GSHistogram&) = delete;
+	GSHistogram& operator=(const GSHistogram&) = delete;
+
+	void observe(double value);
+
+	void write(std::ostream& os, const std::string& name, const std::string& labels) const;
+		/// Writes the _bucket, _sum and _count series in Prometheus text format.
+		/// labels is either empty or a comma separated list like device="png16m".
+
+private:
+	std::vector<double> _bounds;
+	std::unique_ptr<std::atomic<Poco::UInt64>[]> _buckets;	// not cumulative, one past the last bound for +Inf
+	std::atomic<Poco::UInt64> _count{0};
+	std::atomic<double> _sum{0};
+};
+
+
+class GSMetrics
+	/// Process-wide counters and latency histograms of the conversion
+	/// pipeline, rendered by GET /metrics. Recording never takes a lock.
+{
+public:
+	static GSMetrics& instance();
+
+	void upload(Poco::UInt64 bytes);
+	void uploadTimeout();
+	void preflightRejected();
+	void joined();
+	void conversion(const std::string& device, bool ok, double seconds);
+	void conversionFailed(const std::string& device);
+		/// A conversion that ended in an exception, counted without a duration.
+	void send(Poco::UInt64 bytes, double seconds);
+	void sendFailed();
+		/// Counted without a duration, a failed send says nothing about latency.
+	void sendRetry();
+	void queueWait(JobPriority priority, double seconds, bool missedDeadline);
+	void memoryDeferred();
+
+	void write(std::ostream& os) const;
+
+	GSMetrics();
+	GSMetrics(const GSMetrics&) = delete;
+	GSMetrics& operator=(const GSMetrics&) = delete;
+
+private:
+	std::size_t deviceIndex(const std::string& device) const;
+
+	std::vector<std::string> _devices;	// GSPresets::devices() and "other"
+
+	std::atomic<Poco::UInt64> _uploads{0};
+	GSHistogram _uploadBytes;
+	std::atomic<Poco::UInt64> _uploadTimeouts{0};
+	std::atomic<Poco::UInt64> _preflightRejected{0};
+	std::atomic<Poco::UInt64> _joined{0};
+
+	std::unique_ptr<std::atomic<Poco::UInt64>[]> _conversionsOk;
+	std::unique_ptr<std::atomic<Poco::UInt64>[]> _conversionsFailed;
+	std::vector<std::unique_ptr<GSHistogram>> _conversionSeconds;
+
+	std::atomic<Poco::UInt64> _sendsOk{0};
+	std::atomic<Poco::UInt64> _sendsFailed{0};
+	std::atomic<Poco::UInt64> _sendBytes{0};
+	std::atomic<Poco::UInt64> _sendRetries{0};
+	GSHistogram _sendSeconds;
+	GSHistogram _sendRate;		// bytes per second of successful transfers
+
+	std::vector<std::unique_ptr<GSHistogram>> _queueWaitSeconds;	// per priority class
+	std::unique_ptr<std::atomic<Poco::UInt64>[]> _deadlinesMissed;
+	std::atomic<Poco::UInt64> _memoryDeferred{0};
+};
+
+
+#endif // GSMetrics_INCLUDED
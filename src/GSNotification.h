@@ -25,8 +25,59 @@
 
 #include "Poco/Notification.h"
 #include "Poco/String.h"
+#include "Poco/Event.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
 #include <vector>
 #include <memory>
+#include <atomic>
+
+
+enum JobState
+{
+	JOB_RECEIVED,
+	JOB_QUEUED,
+	JOB_CONVERTING,
+	JOB_CONVERTED,
+	JOB_SENDING,
+	JOB_DONE,
+	JOB_FAILED,
+	JOB_CANCELLED,
+	JOB_STATE_COUNT
+};
+
+inline const char* jobStateName(JobState s)
+{
+	static const char* names[JOB_STATE_COUNT] =
+		{ "received", "queued", "converting", "converted", "sending", "done", "failed", "cancelled" };
+	return names[s];
+}
+
+
+enum JobPriority
+{
+	PRIORITY_URGENT,	// mode=sync, someone waits on the connection
+	PRIORITY_HIGH,
+	PRIORITY_NORMAL,
+	PRIORITY_BULK,
+	PRIORITY_COUNT
+};
+
+inline const char* jobPriorityName(JobPriority p)
+{
+	static const char* names[PRIORITY_COUNT] = { "urgent", "high", "normal", "bulk" };
+	return names[p];
+}
+
+
+struct PrinterResult
+{
+	std::string printer;
+	bool done = false;
+	bool ok = false;
+	int attempts = 0;
+	std::string error;
+};
 
 
 struct Job 
@@ -34,9 +85,85 @@ struct Job
 	std::string inputPath;
 	std::string outputPath;
 	std::string formatLabel;
+	std::string device;
 	std::vector<std::string> gsArgs;
 	std::vector<std::string> printers;
 	std::string jobId; 
+	bool stream = false;	// render straight to the printer sockets, no output file
+	int pages = -1;			// -1: not counted
+	std::string cacheKey;	// empty: result cache disabled
+	std::string dedupKey;	// Idempotency-Key or content, see GSJobTable::join
+
+	// scheduling, see GSScheduler
+	JobPriority priority = PRIORITY_NORMAL;
+	Poco::Timestamp::TimeVal deadline = 0;	// 0: none given, the class default applies
+
+	// DELETE /jobs/{id}; the conversion polls it, the sender drops the deliveries
+	std::atomic<bool> cancelled{false};
+	int timeout = 0;		// seconds of rendering, 0: the configured default
+
+	// share of the conversion backlog, held from admission until converted
+	std::atomic<bool> admitted{false};
+	Poco::UInt64 admittedBytes = 0;
+	double cost = 0;		// estimated render cost, see GSAdmission::estimate
+
+	// raster memory, see GSMemoryBudget
+	double mediaWidth = 0;	// points, from the preflight; 0: unknown
+	double mediaHeight = 0;
+	Poco::UInt64 memory = 0;	// reserved while converting
+
+	// mode=sync: the HTTP handler waits for the conversion and returns the output
+	bool sync = false;
+	std::atomic<bool> syncPending{false};	// handler still waiting; cleared by whoever forwards to sendQ
+	Poco::Event converted{Poco::Event::EVENT_MANUALRESET};	// set once the conversion ended, for every job
+	std::atomic<bool> convertedOk{false};
+
+	// printers still to be sent to, and whether all sends so far succeeded
+	std::atomic<int> sendsPending{0};
+	std::atomic<bool> sendsOk{true};
+
+	// status, as reported by GET /jobs/{id}
+	void setState(JobState s)
+	{
+		Poco::FastMutex::ScopedLock lock(statusMutex);
+		state = s;
+		stateTimes[s] = Poco::Timestamp().epochMicroseconds();
+	}
+
+	void setPrinterResult(std::size_t i, bool ok, const std::string& error = std::string())
+	{
+		Poco::FastMutex::ScopedLock lock(statusMutex);
+		initPrinterResults();
+		printerResults[i].done = true;
+		printerResults[i].ok = ok;
+		++printerResults[i].attempts;
+		printerResults[i].error = error;
+	}
+
+	void setPrinterRetry(std::size_t i, const std::string& error)
+		/// A failed attempt that will be retried; the result stays pending.
+	{
+		Poco::FastMutex::ScopedLock lock(statusMutex);
+		initPrinterResults();
+		++printerResults[i].attempts;
+		printerResults[i].error = error;
+	}
+
+	mutable Poco::FastMutex statusMutex;
+	JobState state = JOB_RECEIVED;
+	Poco::Timestamp::TimeVal stateTimes[JOB_STATE_COUNT] = {};	// 0: stage not reached
+	std::vector<PrinterResult> printerResults;
+
+private:
+	void initPrinterResults()
+	{
+		if (printerResults.size() != printers.size())
+		{
+			printerResults.resize(printers.size());
+			for (std::size_t p = 0; p < printers.size(); ++p)
+				printerResults[p].printer = printers[p];
+		}
+	}
 };
 using JobPtr = std::shared_ptr<Job>;
 
@@ -52,4 +179,17 @@ public:
 	JobPtr job;
 };
 
+
+class CancelNotification : public Poco::Notification
+	/// Tells the sender to drop the job's pending, retrying and in-flight deliveries.
+{
+public:
+	CancelNotification(JobPtr j) :
+		job(std::move(j))
+	{
+	}
+
+	JobPtr job;
+};
+
 #endif // GSNotification_INCLUDED
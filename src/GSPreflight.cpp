@@ -0,0 +1,262 @@
+//
+// GSPreflight.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSPreflight.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+namespace
+{
+	// the header may follow some junk, %%EOF some trailing garbage
+	const std::size_t HEADER_WINDOW = 1024;
+	const std::size_t TRAILER_WINDOW = 2048;
+	// how far around /Subtype /Image its /Width and /Height are looked for
+	const std::size_t DICT_WINDOW = 512;
+
+	const char* find(const char* begin, const char* end, const char* needle)
+	{
+		const std::size_t n = std::strlen(needle);
+		if (begin >= end || static_cast<std::size_t>(end - begin) < n)
+			return nullptr;
+		return static_cast<const char*>(memmem(begin, static_cast<std::size_t>(end - begin), needle, n));
+	}
+
+	const char* rfind(const char* begin, const char* end, const char* needle)
+	{
+		const char* last = nullptr;
+		for (const char* p = find(begin, end, needle); p; p = find(p + 1, end, needle))
+			last = p;
+		return last;
+	}
+
+	const char* skipSpace(const char* p, const char* end)
+	{
+		while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+			++p;
+		return p;
+	}
+
+	bool parseNumber(const char* p, const char* end, double& value)
+		/// Parses the number after optional whitespace.
+	{
+		p = skipSpace(p, end);
+		char buffer[32];
+		std::size_t n = 0;
+		while (p < end && n + 1 < sizeof(buffer) && (std::isdigit(static_cast<unsigned char>(*p)) || *p == '.' || *p == '-' || *p == '+'))
+			buffer[n++] = *p++;
+		if (n == 0)
+			return false;
+		buffer[n] = '\0';
+		char* stop = nullptr;
+		value = std::strtod(buffer, &stop);
+		return stop != buffer;
+	}
+
+	bool keyValue(const char* begin, const char* end, const char* key, double& value)
+		/// The number following the first occurrence of a name, e.g. /Width 1600,
+		/// but not of a longer one sharing the prefix.
+	{
+		const std::size_t n = std::strlen(key);
+		for (const char* p = find(begin, end, key); p; p = find(p + 1, end, key))
+		{
+			const char* after = p + n;
+			if (after < end && std::isalnum(static_cast<unsigned char>(*after)))
+				continue;
+			if (parseNumber(after, end, value))
+				return true;
+		}
+		return false;
+	}
+
+	bool isImageSubtype(const char* begin, const char* image)
+		/// Whether /Image at image is the value of /Subtype.
+	{
+		const char* p = image;
+		while (p > begin && std::isspace(static_cast<unsigned char>(p[-1])))
+			--p;
+		static const std::size_t n = std::strlen("/Subtype");
+		return static_cast<std::size_t>(p - begin) >= n && std::memcmp(p - n, "/Subtype", n) == 0;
+	}
+}
+
+
+GSPreflight::GSPreflight(LayeredConfiguration& config, Logger& logger) :
+	_enabled(config.getBool("preflight.enabled", true)),
+	_strict(config.getBool("preflight.strict", false)),
+	_logger(logger)
+{
+}
+
+GSPreflight::~GSPreflight()
+{
+}
+
+GSPreflightResult GSPreflight::check(const std::string& path) const
+{
+	GSPreflightResult result;
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		result.error = "cannot open upload";
+		return result;
+	}
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		::close(fd);
+		result.error = "empty upload";
+		return result;
+	}
+
+	const std::size_t size = static_cast<std::size_t>(st.st_size);
+	void* pMap = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (pMap == MAP_FAILED)
+	{
+		result.error = "cannot map upload";
+		return result;
+	}
+	// one pass from start to end; the pages are still in the page cache from the upload
+	::madvise(pMap, size, MADV_SEQUENTIAL);
+	result = analyze(static_cast<const char*>(pMap), size, _strict);
+	::munmap(pMap, size);
+
+	if (!result.ok)
+		_logger.warning("Preflight of [%s] failed: %s", path, result.error);
+	else if (_logger.debug())
+		_logger.debug("Preflight of [%s]: %d page(s), %.0fx%.0f pt, %d image(s) of %.1f MP%s%s", path, result.pages,
+			result.width, result.height, result.images, result.imageMegapixels,
+			std::string(result.error.empty() ? "" : ", "), result.error);
+	return result;
+}
+
+GSPreflightResult GSPreflight::analyze(const char* data, std::size_t size, bool strict)
+{
+	GSPreflightResult result;
+	const char* end = data + size;
+
+	const char* header = find(data, data + std::min(size, HEADER_WINDOW), "%PDF-");
+	if (!header)
+	{
+		result.error = "no %PDF header";
+		return result;
+	}
+
+	const char* tail = end - std::min(size, TRAILER_WINDOW);
+	if (!rfind(tail, end, "%%EOF"))
+	{
+		result.error = "no %%EOF, truncated upload?";
+		return result;
+	}
+	const char* startxref = rfind(tail, end, "startxref");
+	double xrefOffset = 0;
+	if (!startxref || !parseNumber(startxref + 9, end, xrefOffset))
+	{
+		result.error = "no startxref";
+		return result;
+	}
+
+	// offsets count from the header, which may follow some junk
+	const std::size_t offset = static_cast<std::size_t>(xrefOffset) + static_cast<std::size_t>(header - data);
+	const char* xref = offset < size ? skipSpace(data + offset, end) : nullptr;
+	if (xref && end - xref >= 4 && std::memcmp(xref, "xref", 4) == 0)
+	{
+		if (!find(xref, end, "trailer"))
+			result.error = "xref table without trailer";
+	}
+	else if (xref && std::isdigit(static_cast<unsigned char>(*xref)) && find(xref, std::min(end, xref + DICT_WINDOW), "/XRef"))
+		result.xrefStream = true;
+	else
+		result.error = "startxref does not point to a cross-reference section";
+
+	if (!result.error.empty() && strict)
+		return result;
+	result.ok = true;
+
+	// a linearized file states its page count up front
+	double n = 0;
+	const char* lin = find(header, std::min(end, header + HEADER_WINDOW), "/Linearized");
+	if (lin && keyValue(lin, std::min(end, lin + DICT_WINDOW), "/N", n) && n > 0)
+		result.pages = static_cast<int>(n);
+
+	// otherwise the root page tree node has the largest /Count
+	if (result.pages < 0)
+	{
+		for (const char* p = find(header, end, "/Count"); p; p = find(p + 6, end, "/Count"))
+		{
+			if (parseNumber(p + 6, end, n) && n > result.pages)
+				result.pages = static_cast<int>(n);
+		}
+	}
+
+	const char* mediaBox = find(header, end, "/MediaBox");
+	if (mediaBox)
+	{
+		const char* p = skipSpace(mediaBox + 9, end);
+		double box[4];
+		int i = 0;
+		if (p < end && *p == '[')
+		{
+			++p;
+			for (; i < 4; ++i)
+			{
+				if (!parseNumber(p, end, box[i]))
+					break;
+				p = skipSpace(p, end);
+				while (p < end && !std::isspace(static_cast<unsigned char>(*p)) && *p != ']')
+					++p;
+			}
+		}
+		if (i == 4 && box[2] - box[0] > 0 && box[3] - box[1] > 0)
+		{
+			result.width = box[2] - box[0];
+			result.height = box[3] - box[1];
+		}
+	}
+
+	// image XObjects are streams, never inside object streams, so these are complete
+	for (const char* p = find(header, end, "/Image"); p; p = find(p + 6, end, "/Image"))
+	{
+		if (p + 6 < end && std::isalnum(static_cast<unsigned char>(p[6])))
+			continue;	// /ImageB, /ImageC, /ImageMask
+		if (!isImageSubtype(header, p))
+			continue;
+		const char* from = p - std::min(static_cast<std::size_t>(p - header), DICT_WINDOW);
+		const char* to = std::min(end, p + DICT_WINDOW);
+		double w = 0, h = 0;
+		++result.images;
+		if (keyValue(from, to, "/Width", w) && keyValue(from, to, "/Height", h) && w > 0 && h > 0)
+			result.imageMegapixels += w * h / 1e6;
+	}
+	return result;
+}
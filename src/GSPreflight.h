@@ -0,0 +1,76 @@
+//
+// GSPreflight.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSPreflight_INCLUDED
+#define GSPreflight_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include <string>
+
+
+struct GSPreflightResult
+{
+	bool ok = false;			// false: not a PDF Ghostscript should be given
+	std::string error;			// why not, or a repairable defect when ok
+	bool xrefStream = false;	// cross-reference stream (PDF 1.5+) instead of an xref table
+	int pages = -1;				// -1: hidden in compressed object streams
+	double width = 612;			// first MediaBox, in points
+	double height = 792;
+	int images = 0;				// image XObjects
+	double imageMegapixels = 0;	// their pixels, decoded and scaled when rendering
+};
+
+
+class GSPreflight
+	/// A cheap structural check of an uploaded PDF before it is queued:
+	/// the file is mapped and scanned once for the header, the trailer and
+	/// cross-reference section, the page count, the media size and the
+	/// image XObjects. Nothing is decompressed, so counts inside object
+	/// streams stay unknown.
+	///
+	/// A missing header, %%EOF or startxref (not a PDF, or a truncated
+	/// upload) fails the check. A startxref that points to no xref is a
+	/// defect Ghostscript repairs, and only fails with preflight.strict.
+{
+public:
+	GSPreflight(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSPreflight(const GSPreflight&) = delete;
+	GSPreflight& operator=(const GSPreflight&) = delete;
+
+	~GSPreflight();
+
+	bool enabled() const { return _enabled; }
+
+	GSPreflightResult check(const std::string& path) const;
+
+	static GSPreflightResult analyze(const char* data, std::size_t size, bool strict);
+		/// Runs the checks on a PDF in memory.
+
+private:
+	bool _enabled;
+	bool _strict;
+	Poco::Logger& _logger;
+};
+
+
+#endif // GSPreflight_INCLUDED
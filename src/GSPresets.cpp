@@ -0,0 +1,228 @@
+//
+// GSPresets.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSPresets.h"
+
+#include "Poco/Exception.h"
+#include "Poco/String.h"
+#include "Poco/StringTokenizer.h"
+
+#include <cctype>
+#include <cstring>
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+namespace
+{
+	struct Device
+	{
+		const char* name;
+		const char* extension;
+	};
+
+	// the supported devices, in the order the metrics list them
+	const Device DEVICES[] =
+	{
+		{ "pxlmono", "pcl" }, { "pxlcolor", "pcl" }, { "pcl3", "pcl" }, { "pclm", "pcl" }, { "pclm8", "pcl" },
+		{ "png16m", "png" }, { "png16", "png" }, { "png48", "png" }, { "pngalpha", "png" }, { "pnggray", "png" }, { "pngmono", "png" },
+		{ "jpeg", "jpg" }, { "jpeggray", "jpg" }, { "jpegcmyk", "jpg" }
+	};
+
+	// switches that lift -dSAFER, run PostScript or name files are never compiled in
+	const char* const FORBIDDEN[] =
+	{
+		"dNOSAFER", "dDELAYSAFER", "dWRITESYSTEMDICT", "c", "f", "I", "P", "P-"
+	};
+
+	// string switches whose name ends like this name a file or directory
+	// (sOutputFile, sFONTPATH, sGenericResourceDir, sICCProfilesDir, sstdout, ...)
+	const char* const PATH_SUFFIXES[] =
+	{
+		"file", "path", "dir", "profile", "fontmap", "stdout"
+	};
+
+	bool forbidden(const std::string& key, const std::string& value)
+	{
+		for (const char* f : FORBIDDEN)
+		{
+			if (icompare(key, f) == 0)
+				return true;
+		}
+		if (icompare(key, "dSAFER") == 0)
+			return !value.empty() && icompare(value, "true") != 0;
+		if (key[0] == 's')
+		{
+			for (const char* suffix : PATH_SUFFIXES)
+			{
+				const std::string::size_type n = std::strlen(suffix);
+				if (key.size() > n && icompare(key, key.size() - n, n, std::string(suffix)) == 0)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	bool validName(const std::string& s)
+	{
+		if (s.empty() || !std::isalpha(static_cast<unsigned char>(s[0])))
+			return false;
+		for (char c : s)
+		{
+			if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-')
+				return false;
+		}
+		return true;
+	}
+}
+
+
+GSPresets::GSPresets(LayeredConfiguration& config, Logger& logger) :
+	_only(config.getBool("presets.only", false))
+{
+	AbstractConfiguration::Keys keys;
+	config.keys("preset", keys);
+	for (const auto& name : keys)
+	{
+		GSPreset preset;
+		std::string error;
+		if (!compile(name, config.getString("preset." + name), preset, error))
+			throw InvalidArgumentException("preset." + name, error);
+		logger.debug("Preset %s: %s %s", name, preset.device, cat(std::string(" "), preset.gsArgs.begin(), preset.gsArgs.end()));
+		_presets.emplace(name, std::move(preset));
+	}
+
+	if (_only && _presets.empty())
+		throw InvalidArgumentException("presets.only is set but no preset.* is defined");
+	if (!_presets.empty())
+		logger.information("%z job preset(s)%s.", _presets.size(), std::string(_only ? ", requests must use one" : ""));
+}
+
+GSPresets::~GSPresets()
+{
+}
+
+const GSPreset* GSPresets::find(const std::string& name) const
+{
+	auto it = _presets.find(name);
+	return it == _presets.end() ? nullptr : &it->second;
+}
+
+std::string GSPresets::extension(const std::string& device)
+{
+	for (const auto& d : DEVICES)
+	{
+		if (device == d.name)
+			return d.extension;
+	}
+	return std::string();
+}
+
+const std::vector<std::string>& GSPresets::devices()
+{
+	static const std::vector<std::string> names = []
+	{
+		std::vector<std::string> v;
+		for (const auto& d : DEVICES)
+			v.push_back(d.name);
+		return v;
+	}();
+	return names;
+}
+
+bool GSPresets::compile(const std::string& name, const std::string& spec, GSPreset& preset, std::string& error)
+{
+	if (!validName(name))
+	{
+		error = "invalid preset name";
+		return false;
+	}
+	preset.name = name;
+
+	StringTokenizer tok(spec, ",", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+	for (const auto& t : tok)
+	{
+		const std::string::size_type eq = t.find('=');
+		std::string key = trim(t.substr(0, eq));
+		const std::string value = eq == std::string::npos ? std::string() : trim(t.substr(eq + 1));
+		if (!key.empty() && key[0] == '-')
+			key.erase(0, 1);
+		if (key.empty())
+		{
+			error = "invalid switch [" + t + "]";
+			return false;
+		}
+
+		if (icompare(key, "sDEVICE") == 0)
+		{
+			if (!preset.device.empty())
+			{
+				error = "sDEVICE given twice";
+				return false;
+			}
+			preset.device = value;
+			continue;
+		}
+
+		// -r203 and -g800x600 take their value attached
+		if ((key[0] == 'r' || key[0] == 'g') && key.size() > 1 && std::isdigit(static_cast<unsigned char>(key[1])) && value.empty())
+		{
+			preset.gsArgs.push_back("-" + key);
+			continue;
+		}
+		if ((key == "r" || key == "g") && !value.empty())
+		{
+			preset.gsArgs.push_back("-" + key + value);
+			continue;
+		}
+
+		if (!validName(key))
+		{
+			error = "invalid switch [" + t + "]";
+			return false;
+		}
+		if (forbidden(key, value))
+		{
+			error = "switch not allowed in a preset [" + t + "]";
+			return false;
+		}
+		if (value.empty())
+			preset.gsArgs.push_back("-" + key);
+		else
+			preset.gsArgs.push_back("-" + key + "=" + value);
+	}
+
+	if (preset.device.empty())
+	{
+		error = "missing sDEVICE";
+		return false;
+	}
+	preset.extension = extension(preset.device);
+	if (preset.extension.empty())
+	{
+		error = "unsupported device [" + preset.device + "]";
+		return false;
+	}
+	preset.formatLabel = toUpper(preset.extension);
+	return true;
+}
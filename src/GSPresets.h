@@ -0,0 +1,87 @@
+//
+// GSPresets.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSPresets_INCLUDED
+#define GSPresets_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include <map>
+#include <string>
+#include <vector>
+
+
+struct GSPreset
+	/// A device and switch list compiled from preset.NAME. Only the
+	/// per-job fields (output name, printers, mode, priority, deadline)
+	/// come from the request.
+{
+	std::string name;
+	std::string device;
+	std::string extension;				// pcl, png, jpg
+	std::string formatLabel;			// PCL, PNG, JPG
+	std::vector<std::string> gsArgs;	// without -sDEVICE and -sOutputFile, as the worker expects
+};
+
+
+class GSPresets
+	/// Named job presets from the preset.* properties, e.g.
+	///
+	///     preset.label4x6 = sDEVICE=pxlmono,r=203,dNOPAUSE,dBATCH,dSAFER
+	///
+	/// Every preset is validated and compiled when the service starts;
+	/// a bad one stops the startup. Afterwards the table is immutable and
+	/// read without locking.
+	///
+	/// With presets.only = true requests must name a preset, so clients
+	/// cannot pass arbitrary Ghostscript switches.
+{
+public:
+	GSPresets(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSPresets(const GSPresets&) = delete;
+	GSPresets& operator=(const GSPresets&) = delete;
+
+	~GSPresets();
+
+	const GSPreset* find(const std::string& name) const;
+		/// Returns the preset, or nullptr if there is none by that name.
+
+	bool only() const { return _only; }
+	std::size_t size() const { return _presets.size(); }
+
+	static std::string extension(const std::string& device);
+		/// Output file extension for a supported device, or an empty string.
+
+	static const std::vector<std::string>& devices();
+		/// The supported devices.
+
+	static bool compile(const std::string& name, const std::string& spec, GSPreset& preset, std::string& error);
+		/// Parses a comma separated switch list, written like the query
+		/// parameters of a request (dSAFER, sPAPERSIZE=a4, r=203).
+
+private:
+	std::map<std::string, GSPreset> _presets;
+	bool _only;
+};
+
+
+#endif // GSPresets_INCLUDED
@@ -0,0 +1,192 @@
+//
+// GSPrinterPool.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSPrinterPool.h"
+
+#include "Poco/Net/Socket.h"
+#include "Poco/Net/SocketAddress.h"
+
+
+using namespace Poco;
+using namespace Poco::Net;
+using namespace Poco::Util;
+
+
+const std::string GSPrinterPool::UEL("\x1B%-12345X");
+
+
+GSPrinterPool::GSPrinterPool(LayeredConfiguration& config, Logger& logger) :
+	_keepAlive(config.getBool("printer.keepAlive", false)),
+	_connectTimeout(config.getInt("printer.connectTimeout", 5), 0),
+	_ioTimeout(config.getInt("printer.sendTimeout", 30), 0),
+	_idleTimeout(config.getInt("printer.idleTimeout", 60), 0),
+	_maxIdle(static_cast<std::size_t>(config.getInt("printer.maxIdle", 2))),
+	_logger(logger)
+{
+	if (_keepAlive)
+		_logger.information("Printer connections kept alive for %ds, up to %z idle per printer.",
+			static_cast<int>(_idleTimeout.totalSeconds()), _maxIdle);
+}
+
+GSPrinterPool::~GSPrinterPool()
+{
+}
+
+StreamSocket GSPrinterPool::acquire(const std::string& printer)
+{
+	StreamSocket socket;
+	if (reuse(printer, socket))
+		return socket;
+
+	socket.connect(SocketAddress(printer), _connectTimeout);
+	setup(socket);
+	return socket;
+}
+
+bool GSPrinterPool::reuse(const std::string& printer, StreamSocket& socket)
+{
+	if (!_keepAlive)
+		return false;
+
+	FastMutex::ScopedLock lock(_mutex);
+	sweep();
+	auto it = _idle.find(printer);
+	while (it != _idle.end() && !it->second.empty())
+	{
+		StreamSocket idle = it->second.back().socket;
+		it->second.pop_back();
+		if (healthy(idle))
+		{
+			_logger.debug("Reusing connection to [%s]", printer);
+			socket = idle;
+			return true;
+		}
+		idle.close();
+	}
+	return false;
+}
+
+void GSPrinterPool::expire()
+{
+	if (!_keepAlive)
+		return;
+
+	FastMutex::ScopedLock lock(_mutex);
+	sweep();
+}
+
+void GSPrinterPool::setup(StreamSocket& socket) const
+{
+	socket.setSendTimeout(_ioTimeout);
+	socket.setReceiveTimeout(_ioTimeout);
+	if (_keepAlive)
+		socket.setKeepAlive(true);
+}
+
+void GSPrinterPool::release(const std::string& printer, StreamSocket& socket)
+{
+	if (!_keepAlive)
+	{
+		socket.shutdownSend();
+		socket.close();
+		return;
+	}
+
+	FastMutex::ScopedLock lock(_mutex);
+	auto& idle = _idle[printer];
+	idle.push_back(Idle{socket, Timestamp()});
+	if (idle.size() > _maxIdle)
+	{
+		idle.front().socket.close();
+		idle.erase(idle.begin());
+	}
+}
+
+void GSPrinterPool::beginJob(StreamSocket& socket) const
+{
+	if (_keepAlive)
+		sendAll(socket, UEL);
+}
+
+void GSPrinterPool::endJob(StreamSocket& socket) const
+{
+	if (_keepAlive)
+		sendAll(socket, UEL);
+}
+
+const std::string& GSPrinterPool::jobSeparator() const
+{
+	static const std::string none;
+	return _keepAlive ? UEL : none;
+}
+
+void GSPrinterPool::sendAll(StreamSocket& socket, const std::string& data)
+{
+	std::size_t sent = 0;
+	while (sent < data.size())
+	{
+		int n = socket.sendBytes(data.data() + sent, static_cast<int>(data.size() - sent));
+		if (n <= 0)
+			throw Poco::IOException("connection closed by printer");
+		sent += static_cast<std::size_t>(n);
+	}
+}
+
+bool GSPrinterPool::healthy(StreamSocket& socket)
+{
+	try
+	{
+		if (socket.poll(Timespan(0), Socket::SELECT_ERROR))
+			return false;
+
+		// an idle printer connection only becomes readable when the printer
+		// closed it, or sent status (PJL back channel) which is discarded
+		char buffer[512];
+		while (socket.poll(Timespan(0), Socket::SELECT_READ))
+		{
+			if (socket.available() <= 0)
+				return false;
+			socket.receiveBytes(buffer, sizeof(buffer));
+		}
+		return true;
+	}
+	catch (Poco::Exception&)
+	{
+		return false;
+	}
+}
+
+void GSPrinterPool::sweep()
+{
+	for (auto it = _idle.begin(); it != _idle.end(); )
+	{
+		auto& idle = it->second;
+		while (!idle.empty() && idle.front().since.isElapsed(_idleTimeout.totalMicroseconds()))
+		{
+			idle.front().socket.close();
+			idle.erase(idle.begin());
+		}
+		if (idle.empty())
+			it = _idle.erase(it);
+		else
+			++it;
+	}
+}
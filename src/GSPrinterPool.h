@@ -0,0 +1,108 @@
+//
+// GSPrinterPool.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSPrinterPool_INCLUDED
+#define GSPrinterPool_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include <map>
+#include <string>
+#include <vector>
+
+
+class GSPrinterPool
+	/// Persistent RAW/9100 connections per printer, reused across jobs.
+	///
+	/// With printer.keepAlive disabled every acquire connects and every
+	/// release closes, as before. With it enabled, idle connections are
+	/// health checked before reuse and closed after printer.idleTimeout
+	/// seconds, and every job is framed by PJL UEL sequences so printers
+	/// still separate jobs sent over the same connection.
+{
+public:
+	GSPrinterPool(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSPrinterPool(const GSPrinterPool&) = delete;
+	GSPrinterPool& operator=(const GSPrinterPool&) = delete;
+
+	~GSPrinterPool();
+
+	bool keepAlive() const { return _keepAlive; }
+
+	Poco::Net::StreamSocket acquire(const std::string& printer);
+		/// Returns a connected socket, reusing an idle one if possible.
+		/// Throws if the printer cannot be reached.
+
+	bool reuse(const std::string& printer, Poco::Net::StreamSocket& socket);
+		/// Hands out a healthy idle connection to printer, if there is one.
+		/// Used by the non-blocking sender, which connects on its own.
+
+	void setup(Poco::Net::StreamSocket& socket) const;
+		/// Applies the printer timeouts and keep-alive to a new connection.
+
+	void release(const std::string& printer, Poco::Net::StreamSocket& socket);
+		/// Hands back a socket after a successful job. Sockets of failed
+		/// jobs must not be released; they are simply closed.
+
+	void expire();
+		/// Closes the idle connections past printer.idleTimeout. Called
+		/// periodically, so they are not held once the traffic stops.
+
+	void beginJob(Poco::Net::StreamSocket& socket) const;
+	void endJob(Poco::Net::StreamSocket& socket) const;
+		/// Write the UEL job separators when connections are kept alive.
+
+	const std::string& jobSeparator() const;
+		/// The bytes beginJob and endJob write, for senders doing their own I/O.
+
+	const Poco::Timespan& connectTimeout() const { return _connectTimeout; }
+	const Poco::Timespan& sendTimeout() const { return _ioTimeout; }
+
+	static const std::string UEL;
+
+private:
+	struct Idle
+	{
+		Poco::Net::StreamSocket socket;
+		Poco::Timestamp since;
+	};
+
+	static bool healthy(Poco::Net::StreamSocket& socket);
+	static void sendAll(Poco::Net::StreamSocket& socket, const std::string& data);
+	void sweep();
+
+	bool _keepAlive;
+	Poco::Timespan _connectTimeout;
+	Poco::Timespan _ioTimeout;
+	Poco::Timespan _idleTimeout;
+	std::size_t _maxIdle;
+	std::map<std::string, std::vector<Idle>> _idle;	// most recently used at the back
+	Poco::Logger& _logger;
+	Poco::FastMutex _mutex;
+};
+
+
+#endif // GSPrinterPool_INCLUDED
@@ -0,0 +1,158 @@
+//
+// GSPrinterStream.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSPrinterStream.h"
+
+
+
+using namespace Poco;
+using namespace Poco::Net;
+
+
+GSPrinterStream::GSPrinterStream(const std::vector<std::string>& printers, GSPrinterPool& pool, Logger& logger) :
+	_targets(printers.size()),
+	_pool(pool),
+	_logger(logger)
+{
+	for (std::size_t i = 0; i < printers.size(); ++i)
+		_targets[i].printer = printers[i];
+}
+
+GSPrinterStream::~GSPrinterStream()
+{
+	try
+	{
+		close();
+	}
+	catch (...)
+	{
+		poco_unexpected();
+	}
+}
+
+bool GSPrinterStream::open()
+{
+	bool any = false;
+	for (auto& t : _targets)
+	{
+		try
+		{
+			t.socket = _pool.acquire(t.printer);
+			_pool.beginJob(t.socket);
+			t.ok = true;
+			any = true;
+			_logger.information("Streaming to [%s] ...", t.printer);
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.error("Cannot connect to [%s]: %s", t.printer, ex.displayText());
+		}
+	}
+	return any;
+}
+
+void GSPrinterStream::close()
+{
+	if (_closed)
+		return;
+	_closed = true;
+
+	for (auto& t : _targets)
+	{
+		if (!t.ok)
+			continue;
+		try
+		{
+			_pool.endJob(t.socket);
+			_pool.release(t.printer, t.socket);
+			_logger.information("Streaming %Lu byte(s) to [%s] succesfully completed.", t.bytes, t.printer);
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.error("Closing [%s] failed: %s", t.printer, ex.displayText());
+			t.ok = false;
+		}
+	}
+}
+
+void GSPrinterStream::abort()
+{
+	if (_closed)
+		return;
+	_closed = true;
+
+	for (auto& t : _targets)
+	{
+		if (!t.ok)
+			continue;
+		t.ok = false;
+		try
+		{
+			// no closing UEL, and a reset instead of an orderly shutdown
+			t.socket.setLinger(true, 0);
+			t.socket.close();
+			_logger.warning("Streaming to [%s] aborted after %Lu byte(s).", t.printer, t.bytes);
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.error("Aborting [%s] failed: %s", t.printer, ex.displayText());
+		}
+	}
+}
+
+int GSPrinterStream::write(const char* data, int length)
+{
+	bool any = false;
+	for (auto& t : _targets)
+	{
+		if (!t.ok)
+			continue;
+		try
+		{
+			int sent = 0;
+			while (sent < length)
+			{
+				int n = t.socket.sendBytes(data + sent, length - sent);
+				if (n <= 0)
+					throw Poco::IOException("connection closed by printer");
+				sent += n;
+			}
+			t.bytes += static_cast<Poco::UInt64>(length);
+			any = true;
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.error("Streaming to [%s] failed: %s", t.printer, ex.displayText());
+			t.ok = false;
+		}
+	}
+	return any ? length : -1;
+}
+
+bool GSPrinterStream::allOk() const
+{
+	for (const auto& t : _targets)
+	{
+		if (!t.ok)
+			return false;
+	}
+	return true;
+}
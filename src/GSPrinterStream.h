@@ -0,0 +1,83 @@
+//
+// GSPrinterStream.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSPrinterStream_INCLUDED
+#define GSPrinterStream_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Net/StreamSocket.h"
+#include "GSInstancePool.h"
+#include "GSPrinterPool.h"
+#include <string>
+#include <vector>
+
+
+class GSPrinterStream : public GSOutputSink
+	/// Fans Ghostscript device output out to the printer sockets as it is
+	/// produced, so the first page prints while later pages still render
+	/// and the output never touches the disk.
+	///
+	/// A printer that fails is dropped and the others keep receiving;
+	/// only when all of them failed the job is aborted.
+{
+public:
+	GSPrinterStream(const std::vector<std::string>& printers, GSPrinterPool& pool, Poco::Logger& logger);
+	GSPrinterStream(const GSPrinterStream&) = delete;
+	GSPrinterStream& operator=(const GSPrinterStream&) = delete;
+
+	~GSPrinterStream();
+
+	bool open();
+		/// Connects to all printers. Returns true if at least one is reachable.
+
+	void close();
+		/// Finishes the transfers and hands the connections back to the pool.
+
+	void abort();
+		/// Resets the connections without ending the job, for a render
+		/// that failed midway: the printer must not take the truncated
+		/// output for a complete job, and the connections are not reused.
+
+	int write(const char* data, int length) override;
+
+	bool ok(std::size_t i) const { return _targets[i].ok; }
+		/// Whether printer i received the whole output.
+
+	bool allOk() const;
+
+private:
+	struct Target
+	{
+		std::string printer;
+		Poco::Net::StreamSocket socket;
+		bool ok = false;
+		Poco::UInt64 bytes = 0;
+	};
+
+	std::vector<Target> _targets;
+	GSPrinterPool& _pool;
+	Poco::Logger& _logger;
+	bool _closed = false;
+};
+
+
+#endif // GSPrinterStream_INCLUDED
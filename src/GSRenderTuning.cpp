@@ -0,0 +1,265 @@
+//
+// GSRenderTuning.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSRenderTuning.h"
+
+#include "Poco/Environment.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/String.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+namespace
+{
+	const std::string SWITCHES[] = { "-dNumRenderingThreads", "-dBandHeight", "-dBufferSpace", "-dMaxBitmap" };
+
+	double defaultResolution(const std::string& device)
+	{
+		// the PCL devices default to printer resolutions, the image devices to 72 dpi
+		if (device.compare(0, 3, "pxl") == 0 || device.compare(0, 3, "pcl") == 0)
+			return 300;
+		return 72;
+	}
+}
+
+
+double GSRenderTuning::bytesPerPixel(const std::string& device)
+{
+	if (device == "pxlmono" || device == "pngmono")
+		return 1.0 / 8;
+	if (device == "pnggray" || device == "jpeggray" || device == "png16")
+		return 1;
+	if (device == "jpegcmyk" || device == "pngalpha")
+		return 4;
+	if (device == "png48")
+		return 6;
+	// 24 bit color: pxlcolor, pcl3, pclm, png16m, jpeg
+	return 3;
+}
+
+
+void GSRenderTuning::pageSize(const Job& job, double& width, double& height)
+{
+	double xres = defaultResolution(job.device), yres = xres;
+	double inchesW = 8.5, inchesH = 11;
+	if (job.mediaWidth > 0 && job.mediaHeight > 0)
+	{
+		inchesW = job.mediaWidth / 72;
+		inchesH = job.mediaHeight / 72;
+	}
+	width = height = 0;
+	for (const auto& a : job.gsArgs)
+	{
+		if (a.size() > 2 && a.compare(0, 2, "-g") == 0)
+		{
+			const std::string value = a.substr(2);
+			const std::string::size_type x = value.find('x');
+			if (x != std::string::npos)
+			{
+				NumberParser::tryParseFloat(value.substr(0, x), width);
+				NumberParser::tryParseFloat(value.substr(x + 1), height);
+			}
+		}
+		else if (a.size() > 2 && a.compare(0, 2, "-r") == 0)
+		{
+			const std::string value = a.substr(2);
+			const std::string::size_type x = value.find('x');
+			if (NumberParser::tryParseFloat(value.substr(0, x), xres))
+			{
+				if (x == std::string::npos || !NumberParser::tryParseFloat(value.substr(x + 1), yres))
+					yres = xres;
+			}
+		}
+		else if (icompare(a, 0, 12, std::string("-sPAPERSIZE=")) == 0)
+		{
+			const std::string paper = toLower(a.substr(12));
+			if (paper == "a4")
+			{
+				inchesW = 8.27;
+				inchesH = 11.69;
+			}
+			else if (paper == "a3")
+			{
+				inchesW = 11.69;
+				inchesH = 16.54;
+			}
+			else if (paper == "legal")
+			{
+				inchesW = 8.5;
+				inchesH = 14;
+			}
+			else if (paper == "11x17" || paper == "ledger")
+			{
+				inchesW = 11;
+				inchesH = 17;
+			}
+			else if (paper == "letter")
+			{
+				inchesW = 8.5;
+				inchesH = 11;
+			}
+		}
+	}
+	if (width <= 0 || height <= 0)
+	{
+		width = inchesW * xres;
+		height = inchesH * yres;
+	}
+}
+
+
+void GSRenderParams::appendTo(std::vector<std::string>& gsArgs) const
+{
+	if (!set)
+		return;
+	gsArgs.push_back("-dNumRenderingThreads=" + NumberFormatter::format(threads));
+	if (bandHeight > 0)
+		gsArgs.push_back("-dBandHeight=" + NumberFormatter::format(bandHeight));
+	if (bufferSpace > 0)
+		gsArgs.push_back("-dBufferSpace=" + NumberFormatter::format(bufferSpace));
+	gsArgs.push_back("-dMaxBitmap=" + NumberFormatter::format(maxBitmap));
+}
+
+
+GSRenderTuning::Slot::Slot(GSRenderTuning& tuning, const Job& job, int instances) :
+	_tuning(tuning),
+	_threads(instances)
+{
+	// every instance interprets on a thread of its own, budget or not
+	_tuning._free -= instances;
+	if (!_tuning.tuned(job))
+		return;
+
+	int threads = 0;
+	double width, height;
+	pageSize(job, width, height);
+	if (width * height >= _tuning._minMegapixels * 1e6 && _tuning._maxThreads > 1)
+	{
+		// first come, first served; the instances split the grant evenly
+		const int taken = _tuning.take(instances * (_tuning._maxThreads - 1));
+		const int extra = taken / instances;
+		_tuning._free += taken - extra * instances;
+		_threads += extra * instances;
+		if (extra > 0)
+			threads = extra + 1;
+	}
+	_params = _tuning.params(job, threads);
+}
+
+GSRenderTuning::Slot::~Slot()
+{
+	_tuning._free += _threads;
+}
+
+
+GSRenderTuning::GSRenderTuning(LayeredConfiguration& config, Logger& logger) :
+	_cores(static_cast<int>(Poco::Environment::processorCount())),
+	_enabled(config.getBool("render.tuning", true)),
+	_maxThreads(config.getInt("render.maxThreads", _cores)),
+	_minMegapixels(config.getDouble("render.minMegapixels", 8)),
+	_bandsPerThread(std::max(1, config.getInt("render.bandsPerThread", 4))),
+	_minBufferSpace(static_cast<long>(config.getInt64("render.minBufferSpace", 4)) * 1024 * 1024),
+	_maxBufferSpace(static_cast<long>(config.getInt64("render.maxBufferSpace", 64)) * 1024 * 1024),
+	_maxBitmap(static_cast<long>(config.getInt64("render.maxBitmap", 32)) * 1024 * 1024),
+	_free(_cores)
+{
+	if (_enabled)
+		logger.information("Rendering threads: up to %d per conversion from a budget of %d core(s).", _maxThreads, _cores);
+}
+
+GSRenderTuning::~GSRenderTuning()
+{
+}
+
+GSRenderParams GSRenderTuning::params(const Job& job, int threads) const
+{
+	GSRenderParams p;
+	p.set = true;
+	p.maxBitmap = _maxBitmap;
+	if (threads < 2)
+		return p;
+
+	// enough bands for every thread to have work queued behind the current one
+	double width, height;
+	pageSize(job, width, height);
+	const int bands = threads * _bandsPerThread;
+	p.threads = threads;
+	p.bandHeight = std::max(16, static_cast<int>(std::ceil(height / bands)));
+	const double rowBytes = std::ceil(width * bytesPerPixel(job.device));
+	// each thread holds a band buffer of its own on top of the command list
+	const double needed = rowBytes * p.bandHeight * (threads + 1) * 2;
+	p.bufferSpace = static_cast<long>(std::min<double>(_maxBufferSpace, std::max<double>(_minBufferSpace, needed)));
+	return p;
+}
+
+int GSRenderTuning::take(int wanted)
+{
+	int free = _free.load();
+	int taken;
+	do
+	{
+		taken = std::max(0, std::min(wanted, free));
+	}
+	while (taken > 0 && !_free.compare_exchange_weak(free, free - taken));
+	return taken;
+}
+
+Poco::UInt64 GSRenderTuning::rasterBytes(const Job& job) const
+{
+	double width, height;
+	pageSize(job, width, height);
+	const double bitmap = std::ceil(width * bytesPerPixel(job.device)) * height;
+	if (!tuned(job) || bitmap <= _maxBitmap)
+		return static_cast<Poco::UInt64>(bitmap);
+
+	// banded: the command list lives in BufferSpace, and every rendering
+	// thread rasterizes into a band buffer of its own on top of it; the
+	// grant is not known yet, so count all the threads it may come to
+	Poco::UInt64 bytes = static_cast<Poco::UInt64>(std::min<double>(bitmap, _maxBufferSpace));
+	if (width * height >= _minMegapixels * 1e6 && _maxThreads > 1)
+	{
+		const GSRenderParams p = params(job, _maxThreads);
+		bytes += static_cast<Poco::UInt64>(std::ceil(width * bytesPerPixel(job.device)) * p.bandHeight * p.threads);
+	}
+	return bytes;
+}
+
+bool GSRenderTuning::tuned(const Job& job) const
+{
+	if (!_enabled)
+		return false;
+	for (const auto& a : job.gsArgs)
+	{
+		for (const auto& s : SWITCHES)
+		{
+			if (a.compare(0, s.size(), s) == 0)
+				return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,126 @@
+//
+// GSRenderTuning.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSRenderTuning_INCLUDED
+#define GSRenderTuning_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+
+struct GSRenderParams
+	/// Banded rendering settings for one conversion.
+{
+	bool set = false;		// false: the client chose its own, leave the device alone
+	int threads = 0;		// NumRenderingThreads, 0: render bands on the interpreter thread
+	int bandHeight = 0;		// BandHeight in device rows, 0: Ghostscript decides
+	long bufferSpace = 0;	// BufferSpace in bytes, 0: left as it is
+	long maxBitmap = 0;		// MaxBitmap in bytes, larger pages are banded
+
+	void appendTo(std::vector<std::string>& gsArgs) const;
+		/// Adds the settings as -d switches, for one-shot instances.
+};
+
+
+class GSRenderTuning
+	/// Sizes Ghostscript's multithreaded banded rendering for every
+	/// conversion from a budget of one thread per core: every running
+	/// instance holds one, and a conversion of a large page is granted
+	/// up to render.maxThreads - 1 more of those still free when it
+	/// starts, returned when it ends. A lone large raster job renders its
+	/// bands on the idle cores, while a full house of workers gets no
+	/// extra threads at all. Band height and buffer space follow from the
+	/// page size, resolution and device depth.
+	///
+	/// MaxBitmap (render.maxBitmap megabytes) is set explicitly, so pages
+	/// above it are rendered in bands through BufferSpace instead of into
+	/// a full-page bitmap, whatever the Ghostscript build defaults to.
+	///
+	/// Jobs whose switches already set NumRenderingThreads, BandHeight,
+	/// BufferSpace or MaxBitmap are left as they are.
+{
+public:
+	class Slot
+		/// The threads of a running conversion (or its shards), held while
+		/// in scope: one per instance, taken even beyond the budget, plus
+		/// the rendering threads granted from what was free.
+	{
+	public:
+		Slot(GSRenderTuning& tuning, const Job& job, int instances = 1);
+		~Slot();
+
+		Slot(const Slot&) = delete;
+		Slot& operator=(const Slot&) = delete;
+
+		const GSRenderParams& params() const { return _params; }
+			/// Settings for each of the instances.
+
+	private:
+		GSRenderTuning& _tuning;
+		int _threads;	// taken from the budget
+		GSRenderParams _params;
+	};
+
+	GSRenderTuning(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSRenderTuning(const GSRenderTuning&) = delete;
+	GSRenderTuning& operator=(const GSRenderTuning&) = delete;
+
+	~GSRenderTuning();
+
+	bool enabled() const { return _enabled; }
+
+	Poco::UInt64 rasterBytes(const Job& job) const;
+		/// The raster memory one instance needs for the job: the full-page
+		/// bitmap, or the band buffer space once the page is banded.
+
+	int free() const { return _free; }
+		/// Threads of the budget not held by any conversion, negative
+		/// while more instances run than there are cores.
+
+	static double bytesPerPixel(const std::string& device);
+
+	static void pageSize(const Job& job, double& width, double& height);
+		/// Page size in device pixels from -g, or -r and -sPAPERSIZE,
+		/// or the media size the preflight found.
+
+private:
+	bool tuned(const Job& job) const;
+	GSRenderParams params(const Job& job, int threads) const;
+	int take(int wanted);
+
+	int _cores;
+	bool _enabled;
+	int _maxThreads;			// per conversion
+	double _minMegapixels;		// smaller pages render on one thread
+	int _bandsPerThread;
+	long _minBufferSpace;
+	long _maxBufferSpace;
+	long _maxBitmap;
+	std::atomic<int> _free;
+};
+
+
+#endif // GSRenderTuning_INCLUDED
@@ -0,0 +1,221 @@
+//
+// GSResultCache.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSResultCache.h"
+
+#include "Poco/Path.h"
+#include "Poco/File.h"
+#include "Poco/DirectoryIterator.h"
+#include "Poco/SHA1Engine.h"
+#include "Poco/DigestEngine.h"
+#include "Poco/Timestamp.h"
+
+#include <algorithm>
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+GSResultCache::GSResultCache(LayeredConfiguration& config, Logger& logger) :
+	_enabled(config.getBool("cache.enabled", false)),
+	_maxBytes(static_cast<Poco::UInt64>(config.getInt64("cache.maxBytes", 1024LL * 1024 * 1024))),
+	_logger(logger)
+{
+	if (!_enabled)
+		return;
+
+	Poco::Path dir(Poco::Path::forDirectory(config.getString("filesDir")));
+	dir.pushDirectory("cache");
+	_dir = Poco::Path::forDirectory(config.getString("cache.dir", dir.toString())).toString();
+	Poco::File(_dir).createDirectories();
+
+	load();
+	_logger.information("Result cache [%s]: %z entries, %Lu of %Lu byte(s) used.", _dir, _index.size(), _bytes, _maxBytes);
+}
+
+GSResultCache::~GSResultCache()
+{
+}
+
+std::string GSResultCache::makeKey(const std::string& pdfDigest, const std::string& device, const std::vector<std::string>& gsArgs,
+	const std::string& outputPath)
+{
+	// a later switch may override an earlier one, so the order is part of the key;
+	// so is a page pattern, per-page output is not the single file
+	const std::string name = Poco::Path(outputPath).getFileName();
+	const std::string::size_type pattern = name.find('%');
+
+	Poco::SHA1Engine sha1;
+	sha1.update(pdfDigest);
+	sha1.update('\n');
+	sha1.update(device);
+	sha1.update('\n');
+	sha1.update(pattern == std::string::npos ? std::string() : name.substr(pattern));
+	for (const auto& a : gsArgs)
+	{
+		sha1.update('\n');
+		sha1.update(a);
+	}
+	return Poco::DigestEngine::digestToHex(sha1.digest());
+}
+
+bool GSResultCache::fetch(const std::string& key, const std::string& outputPath)
+{
+	std::string path;
+	{
+		FastMutex::ScopedLock lock(_mutex);
+		auto it = _index.find(key);
+		if (it == _index.end())
+		{
+			++_misses;
+			return false;
+		}
+		_lru.splice(_lru.begin(), _lru, it->second);
+		path = it->second->path;
+	}
+
+	try
+	{
+		place(path, outputPath);
+		Poco::File(path).setLastModified(Poco::Timestamp());
+		++_hits;
+		return true;
+	}
+	catch (Poco::Exception& ex)
+	{
+		_logger.warning("Dropping cache entry [%s]: %s", path, ex.displayText());
+	}
+
+	FastMutex::ScopedLock lock(_mutex);
+	auto it = _index.find(key);
+	if (it != _index.end())
+	{
+		_bytes -= it->second->size;
+		_lru.erase(it->second);
+		_index.erase(it);
+	}
+	++_misses;
+	return false;
+}
+
+void GSResultCache::store(const std::string& key, const std::string& outputPath)
+{
+	Poco::Path cached(_dir, key);
+	cached.setExtension(Poco::Path(outputPath).getExtension());
+	const std::string path = cached.toString();
+
+	Poco::UInt64 size = 0;
+	try
+	{
+		place(outputPath, path);
+		size = static_cast<Poco::UInt64>(Poco::File(path).getSize());
+	}
+	catch (Poco::Exception& ex)
+	{
+		_logger.error("Caching [%s] failed: %s", outputPath, ex.displayText());
+		return;
+	}
+
+	FastMutex::ScopedLock lock(_mutex);
+	auto it = _index.find(key);
+	if (it != _index.end())
+	{
+		_bytes -= it->second->size;
+		_lru.erase(it->second);
+		_index.erase(it);
+	}
+	_lru.push_front(Entry{key, path, size});
+	_index[key] = _lru.begin();
+	_bytes += size;
+	evict();
+}
+
+Poco::UInt64 GSResultCache::bytes() const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _bytes;
+}
+
+void GSResultCache::load()
+{
+	struct Found
+	{
+		Entry entry;
+		Poco::Timestamp used;
+	};
+	std::vector<Found> found;
+
+	for (Poco::DirectoryIterator it(_dir), end; it != end; ++it)
+	{
+		if (!it->isFile())
+			continue;
+		found.push_back(Found{Entry{it.path().getBaseName(), it.path().toString(),
+			static_cast<Poco::UInt64>(it->getSize())}, it->getLastModified()});
+	}
+
+	std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.used < b.used; });
+	for (auto& f : found)
+	{
+		_bytes += f.entry.size;
+		_lru.push_front(std::move(f.entry));
+		_index[_lru.front().key] = _lru.begin();
+	}
+	evict();
+}
+
+void GSResultCache::evict()
+{
+	while (_bytes > _maxBytes && !_lru.empty())
+	{
+		const Entry& e = _lru.back();
+		try
+		{
+			Poco::File(e.path).remove();
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.warning("Evicting [%s]: %s", e.path, ex.displayText());
+		}
+		_logger.debug("Evicted cache entry [%s]", e.path);
+		_bytes -= e.size;
+		_index.erase(e.key);
+		_lru.pop_back();
+	}
+}
+
+void GSResultCache::place(const std::string& from, const std::string& to)
+{
+	// hard links are safe because the worker unlinks an output file before
+	// rendering over it, so a cached inode is never rewritten in place
+	Poco::File target(to);
+	if (target.exists())
+		target.remove();
+
+	try
+	{
+		Poco::File(from).linkTo(to, Poco::File::LINK_HARD);
+	}
+	catch (Poco::Exception&)
+	{
+		Poco::File(from).copyTo(to);
+	}
+}
@@ -0,0 +1,96 @@
+//
+// GSResultCache.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSResultCache_INCLUDED
+#define GSResultCache_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+class GSResultCache
+	/// Content-addressed cache of conversion results. The key is a hash of
+	/// the PDF bytes, the device, the Ghostscript switches and the output's
+	/// page pattern, so a resent document skips Ghostscript entirely.
+	///
+	/// Entries live as files in cache.dir and are evicted least recently
+	/// used first once they exceed cache.maxBytes.
+{
+public:
+	GSResultCache(Poco::Util::LayeredConfiguration& config, Poco::Logger& logger);
+	GSResultCache(const GSResultCache&) = delete;
+	GSResultCache& operator=(const GSResultCache&) = delete;
+
+	~GSResultCache();
+
+	bool enabled() const { return _enabled; }
+
+	static std::string makeKey(const std::string& pdfDigest, const std::string& device, const std::vector<std::string>& gsArgs,
+		const std::string& outputPath);
+		/// Combines the hex digest of the PDF bytes with the device, the
+		/// switches in request order and the page pattern of the output
+		/// name (%d), if any.
+
+	bool fetch(const std::string& key, const std::string& outputPath);
+		/// On a hit, places the cached result at outputPath and returns true.
+
+	void store(const std::string& key, const std::string& outputPath);
+		/// Adds a freshly converted result, evicting old entries as needed.
+
+	Poco::UInt64 hits() const { return _hits; }
+	Poco::UInt64 misses() const { return _misses; }
+	Poco::UInt64 bytes() const;
+
+private:
+	struct Entry
+	{
+		std::string key;
+		std::string path;
+		Poco::UInt64 size;
+	};
+	using EntryList = std::list<Entry>;
+
+	void load();
+	void evict();
+	static void place(const std::string& from, const std::string& to);
+
+	bool _enabled;
+	std::string _dir;
+	Poco::UInt64 _maxBytes;
+	Poco::UInt64 _bytes = 0;
+	EntryList _lru;			// most recently used at the front
+	std::unordered_map<std::string, EntryList::iterator> _index;
+	std::atomic<Poco::UInt64> _hits{0};
+	std::atomic<Poco::UInt64> _misses{0};
+	Poco::Logger& _logger;
+	mutable Poco::FastMutex _mutex;
+};
+
+
+#endif // GSResultCache_INCLUDED
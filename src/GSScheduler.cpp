@@ -0,0 +1,229 @@
+//
+// GSScheduler.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSScheduler.h"
+#include "GSMetrics.h"
+
+#include "Poco/NumberParser.h"
+#include "Poco/String.h"
+
+#include <algorithm>
+
+
+using namespace Poco;
+using namespace Poco::Util;
+
+
+GSScheduler::GSScheduler(LayeredConfiguration& config) :
+	_aging(config.getInt("sched.aging", 30), 0),
+	_costDelay(config.getDouble("sched.costDelay", 1)),
+	_gateWait(config.getInt("sched.memoryWait", 30), 0)
+{
+	static const int defaultSlack[PRIORITY_COUNT] = { 5, 60, 600, 3600 };
+	for (int c = 0; c < PRIORITY_COUNT; ++c)
+	{
+		const std::string key = std::string("sched.slack.") + jobPriorityName(static_cast<JobPriority>(c));
+		_slack[c] = Timespan(config.getInt(key, defaultSlack[c]), 0);
+	}
+}
+
+GSScheduler::~GSScheduler()
+{
+}
+
+void GSScheduler::enqueue(const JobPtr& job)
+{
+	EntryPtr pEntry(new Entry);
+	pEntry->job = job;
+	if (job->deadline)
+	{
+		// a client's deadline is kept as given, whatever the job costs
+		pEntry->deadline = job->deadline;
+	}
+	else
+	{
+		const Timestamp::TimeDiff slack = _slack[job->priority].totalMicroseconds();
+		pEntry->deadline = pEntry->enqueued.epochMicroseconds() + slack;
+		if (_costDelay > 0 && job->cost > 0)
+			pEntry->deadline += std::min(slack, static_cast<Timestamp::TimeDiff>(job->cost * _costDelay * Timespan::SECONDS));
+	}
+
+	FastMutex::ScopedLock lock(_mutex);
+	pEntry->seq = ++_seq;
+	Class& cls = _classes[job->priority];
+	cls.byDeadline.insert(pEntry);
+	cls.byArrival.insert(pEntry);
+	++_size;
+	_ready.signal();
+}
+
+JobPtr GSScheduler::waitDequeue(long milliseconds, Gate* pGate)
+{
+	EntryPtr pEntry;
+	{
+		FastMutex::ScopedLock lock(_mutex);
+		if (_size == 0 && !_ready.tryWait(_mutex, milliseconds))
+			return JobPtr();
+		if (_size == 0)
+			return JobPtr();
+		pEntry = next(pGate);
+		if (!pEntry)
+		{
+			// nothing may start before a running job gives something back
+			_ready.tryWait(_mutex, milliseconds);
+			return JobPtr();
+		}
+	}
+
+	const JobPtr& job = pEntry->job;
+	const bool late = job->deadline && Timestamp().epochMicroseconds() > job->deadline;
+	GSMetrics::instance().queueWait(job->priority, pEntry->enqueued.elapsed() / 1e6, late);
+	return job;
+}
+
+void GSScheduler::notify()
+{
+	FastMutex::ScopedLock lock(_mutex);
+	_ready.broadcast();
+}
+
+bool GSScheduler::remove(const JobPtr& job)
+{
+	FastMutex::ScopedLock lock(_mutex);
+	Class& cls = _classes[job->priority];
+	for (auto it = cls.byArrival.begin(); it != cls.byArrival.end(); ++it)
+	{
+		if ((*it)->job == job)
+		{
+			const EntryPtr pEntry = *it;
+			cls.byArrival.erase(it);
+			cls.byDeadline.erase(pEntry);
+			--_size;
+			return true;
+		}
+	}
+	return false;
+}
+
+GSScheduler::EntryPtr GSScheduler::next(Gate* pGate)
+{
+	const Timestamp now;
+	EntryPtr pNext = best(now);
+	if (pGate && !pGate->tryStart(*pNext->job))
+	{
+		if (!pNext->heldSince)
+		{
+			pNext->heldSince = now.epochMicroseconds();
+			GSMetrics::instance().memoryDeferred();
+		}
+		if (_gateWait.totalMicroseconds() > 0 && now.epochMicroseconds() - pNext->heldSince >= _gateWait.totalMicroseconds())
+			return EntryPtr();
+
+		// in the meantime the first job in class and deadline order that passes
+		const EntryPtr pHeld = std::move(pNext);
+		for (int c = 0; c < PRIORITY_COUNT && !pNext; ++c)
+		{
+			for (const auto& pEntry : _classes[c].byDeadline)
+			{
+				if (pEntry != pHeld && pGate->tryStart(*pEntry->job))
+				{
+					pNext = pEntry;
+					break;
+				}
+			}
+		}
+		if (!pNext)
+			return EntryPtr();
+	}
+
+	Class& cls = _classes[pNext->job->priority];
+	cls.byDeadline.erase(pNext);
+	cls.byArrival.erase(pNext);
+	--_size;
+	return pNext;
+}
+
+GSScheduler::EntryPtr GSScheduler::best(const Timestamp& now) const
+{
+	// every class offers its earliest deadline at its own rank, and its
+	// longest waiting job at the rank aging has promoted it to
+	EntryPtr pBest;
+	int bestRank = PRIORITY_COUNT;
+	for (int c = 0; c < PRIORITY_COUNT; ++c)
+	{
+		const Class& cls = _classes[c];
+		if (cls.byDeadline.empty())
+			continue;
+
+		const EntryPtr& pHead = *cls.byDeadline.begin();
+		const EntryPtr& pOldest = *cls.byArrival.begin();
+		const int agedRank = aged(c, *pOldest, now);
+
+		const EntryPtr& pCandidate = agedRank < c ? pOldest : pHead;
+		const int rank = agedRank < c ? agedRank : c;
+		if (!pBest || rank < bestRank || (rank == bestRank && ByDeadline()(pCandidate, pBest)))
+		{
+			pBest = pCandidate;
+			bestRank = rank;
+		}
+	}
+	return pBest;
+}
+
+int GSScheduler::aged(int cls, const Entry& entry, const Timestamp& now) const
+{
+	if (_aging.totalMicroseconds() <= 0)
+		return cls;
+	const Timestamp::TimeDiff waited = now - entry.enqueued;
+	const int steps = static_cast<int>(waited / _aging.totalMicroseconds());
+	return steps >= cls ? 0 : cls - steps;
+}
+
+std::size_t GSScheduler::size() const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _size;
+}
+
+std::size_t GSScheduler::size(JobPriority priority) const
+{
+	FastMutex::ScopedLock lock(_mutex);
+	return _classes[priority].byDeadline.size();
+}
+
+bool GSScheduler::parsePriority(const std::string& value, JobPriority& priority)
+{
+	for (int c = 0; c < PRIORITY_COUNT; ++c)
+	{
+		if (Poco::icompare(value, jobPriorityName(static_cast<JobPriority>(c))) == 0)
+		{
+			priority = static_cast<JobPriority>(c);
+			return true;
+		}
+	}
+	int n = 0;
+	if (NumberParser::tryParse(value, n) && n >= 0 && n < PRIORITY_COUNT)
+	{
+		priority = static_cast<JobPriority>(n);
+		return true;
+	}
+	return false;
+}
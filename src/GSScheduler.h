@@ -0,0 +1,146 @@
+//
+// GSScheduler.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSScheduler_INCLUDED
+#define GSScheduler_INCLUDED
+
+
+#include "Poco/Condition.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include <memory>
+#include <set>
+
+
+class GSScheduler
+	/// The conversion queue in front of the workers, replacing a FIFO.
+	///
+	/// Jobs are taken by priority class (urgent, high, normal, bulk) and
+	/// earliest deadline first within a class. A job without a deadline
+	/// gets its arrival time plus the sched.slack.<class> seconds, so such
+	/// jobs are served in arrival order.
+	///
+	/// Within a class, expensive jobs yield to cheap ones: the implicit
+	/// deadline of a job is pushed back by sched.costDelay seconds per unit
+	/// of estimated render cost (see GSAdmission::estimate), at most by the
+	/// class slack. A deadline the client set is never moved. Under load
+	/// a one page label no longer waits behind a 300 page catalog that
+	/// arrived a moment earlier; on an idle server the order makes no
+	/// difference.
+	///
+	/// Against starvation, a job is promoted by one class for every
+	/// sched.aging seconds it has waited: bulk work keeps moving even
+	/// under a steady stream of urgent jobs.
+	///
+	/// A Gate passed to waitDequeue can hold a job back, e.g. until enough
+	/// memory is free (see GSMemoryBudget). Jobs behind it that pass the
+	/// gate go first, until the held job has waited sched.memoryWait
+	/// seconds; from then on nothing else starts until it fits.
+{
+public:
+	class Gate
+		/// Decides whether a job may start now, and takes what it needs if so.
+	{
+	public:
+		virtual ~Gate() = default;
+
+		virtual bool tryStart(Job& job) = 0;
+			/// Called with the scheduler locked; must be quick and not block.
+	};
+
+	explicit GSScheduler(Poco::Util::LayeredConfiguration& config);
+	GSScheduler(const GSScheduler&) = delete;
+	GSScheduler& operator=(const GSScheduler&) = delete;
+
+	~GSScheduler();
+
+	void enqueue(const JobPtr& job);
+
+	JobPtr waitDequeue(long milliseconds, Gate* pGate = nullptr);
+		/// Returns the next job to convert, or an empty pointer if
+		/// none arrived (or passed the gate) within the given time.
+
+	void notify();
+		/// Wakes the waiting workers after a gate's resources were freed.
+
+	bool remove(const JobPtr& job);
+		/// Takes a queued job out again. Returns false if a worker
+		/// already has it (or it was never queued).
+
+	std::size_t size() const;
+	std::size_t size(JobPriority priority) const;
+
+	static bool parsePriority(const std::string& value, JobPriority& priority);
+		/// Accepts a class name or its number, 0 (urgent) to 3 (bulk).
+
+private:
+	struct Entry
+	{
+		JobPtr job;
+		Poco::Timestamp enqueued;
+		Poco::Timestamp::TimeVal deadline;	// sort key: the job's deadline plus its cost delay
+		Poco::UInt64 seq;		// tie breaker, arrival order
+		Poco::Timestamp::TimeVal heldSince = 0;	// 0: never held back by the gate
+	};
+	using EntryPtr = std::shared_ptr<Entry>;
+
+	struct ByDeadline
+	{
+		bool operator()(const EntryPtr& a, const EntryPtr& b) const
+		{
+			return a->deadline != b->deadline ? a->deadline < b->deadline : a->seq < b->seq;
+		}
+	};
+
+	struct ByArrival
+	{
+		bool operator()(const EntryPtr& a, const EntryPtr& b) const
+		{
+			return a->seq < b->seq;
+		}
+	};
+
+	struct Class
+	{
+		std::set<EntryPtr, ByDeadline> byDeadline;
+		std::set<EntryPtr, ByArrival> byArrival;
+	};
+
+	EntryPtr next(Gate* pGate);
+	EntryPtr best(const Poco::Timestamp& now) const;
+	int aged(int cls, const Entry& entry, const Poco::Timestamp& now) const;
+
+	Poco::Timespan _aging;		// zero: no promotion
+	double _costDelay;			// seconds per cost unit, zero: cost is ignored
+	Poco::Timespan _gateWait;	// zero: a held job never stops the others
+	Poco::Timespan _slack[PRIORITY_COUNT];
+	Class _classes[PRIORITY_COUNT];
+	std::size_t _size = 0;
+	Poco::UInt64 _seq = 0;
+	mutable Poco::FastMutex _mutex;
+	Poco::Condition _ready;
+};
+
+
+#endif // GSScheduler_INCLUDED
@@ -21,25 +21,27 @@
 
 #include "GSSenderTask.h"
 #include "GSNotification.h"
+#include "GSMetrics.h"
+#include "GSPrinterPool.h"
 
 #include "Poco/Notification.h"
 #include "Poco/AutoPtr.h"
+#include "Poco/Error.h"
+#include "Poco/Exception.h"
 #include "Poco/Logger.h"
-#include "Poco/Thread.h"
 #include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
 #include "Poco/File.h"
-#include "Poco/FileStream.h"
-#include "Poco/StreamCopier.h"
 
-#include "Poco/Net/StreamSocket.h"
-#include "Poco/Net/SocketStream.h"
+#include "Poco/Net/NetException.h"
 #include "Poco/Net/SocketAddress.h"
 
-#include "Poco/String.h"
-#include "Poco/StringTokenizer.h"
+#include <algorithm>
 #include <vector>
-#include <memory>
-#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
 
 
 using namespace Poco;
@@ -47,76 +49,45 @@ using namespace Poco::Net;
 using namespace Poco::Util;
 
 
-//
-// Send Runnable
-//
-
-class SendRunnable : public Poco::Runnable {
-public:
-	SendRunnable(Logger& logger, const std::string& file, const std::string& printer, bool readonly)
-		: _logger(logger), _file(file), _printer(printer), _readonly(readonly) 
-	{
-	}
-
-	void run() override 
-	{
-		if (!Poco::File(_file).exists()) 
-		{
-			_logger.error("File [%s] does not exist.", _file);
-			_ok = false;
-			return;
-		}
-
-		try 
-		{
-			if (_readonly) 
-			{ 
-				_ok = true; 
-				_logger.information("READONLY: Would send [%s] to [%s] ...", _file, _printer);
-				return; 
-			}
-
-			_logger.information("Sending [%s] to [%s] ...", _file, _printer);
-			Poco::FileInputStream fis(_file);
-			Poco::Net::StreamSocket sock;
-			sock.connect(Poco::Net::SocketAddress(_printer), Poco::Timespan(5,0));
-			sock.setSendTimeout(Poco::Timespan(30,0));
-			sock.setReceiveTimeout(Poco::Timespan(30,0));
-			Poco::Net::SocketStream ss(sock);
-			Poco::StreamCopier::copyStream(fis, ss);
-			_logger.information("Sending [%s] to [%s] succesfully completed.", _file, _printer);
-			_ok = true;
-		} 
-		catch (...) 
-		{
-			_ok = false;
-		}
-	}
-
-	bool ok() const 
-	{ 
-		return _ok; 
-	}
+namespace
+{
+	// how long the loop sleeps in poll while transfers are in flight;
+	// new jobs are picked up from sendQ between polls
+	const Timespan POLL_INTERVAL(0, 10000);
 
-private:
-	Poco::Logger& _logger;
-	std::string _file;
-	std::string _printer;
-	bool _readonly{true};
-	std::atomic<bool> _ok{false};
-};
+	// bytes a transfer may write per readiness event before the loop
+	// moves on, so a fast printer does not starve the others
+	const std::size_t PUMP_BUDGET = 1024 * 1024;
 
+	const std::size_t BUFFER_SIZE = 64 * 1024;
+}
 
 
-GSSenderTask::GSSenderTask(Poco::NotificationQueue& sendQ, Logger& logger, LayeredConfiguration& config) :
+GSSenderTask::GSSenderTask(Poco::NotificationQueue& sendQ, GSPrinterPool& printerPool, GSDeadLetter& deadLetter,
+		GSJournal& journal, Logger& logger, LayeredConfiguration& config) :
 	Task("GSSenderTask"),
 	_logger(logger),
 	_sendQ(sendQ),
+	_printerPool(printerPool),
+	_deadLetter(deadLetter),
+	_journal(journal),
 	_readonly(config.getBool("readonly", true)),
-	_disposal(config.getBool("disposal", false))
+	_disposal(config.getBool("disposal", false)),
+	_sendfile(config.getBool("sender.sendfile", true)),
+	_perPrinter(config.getInt("sender.perPrinter", 1)),
+	_maxActive(config.getInt("sender.maxTransfers", 1024)),
+	_maxRetries(config.getInt("sender.retries", 5)),
+	_retryDelay(config.getInt("sender.retryDelay", 2), 0),
+	_retryMaxDelay(config.getInt("sender.retryMaxDelay", 300), 0),
+	_buffer(BUFFER_SIZE)
 {
+	if (_perPrinter < 1)
+		_perPrinter = 1;
+	if (_maxActive < 1)
+		_maxActive = 1;
 	if (_disposal)
 		_logger.warning("Files will be deleted after successful print.");
+	_random.seed();
 }
 
 GSSenderTask::~GSSenderTask()
@@ -130,75 +101,444 @@ void GSSenderTask::runTask()
 	{
 		try
 		{
-			if (Notification::Ptr nf = _sendQ.waitDequeueNotification(1000))
+			// with nothing in flight there is nothing to poll, so block on the
+			// queue; otherwise only look at it between polls. Pending retries
+			// bound the wait to the timer wheel's tick.
+			Notification::Ptr nf;
+			if (!_transfers.empty())
+				nf = _sendQ.dequeueNotification();
+			else
+				nf = _sendQ.waitDequeueNotification(_retries.empty() ? 1000 : 100);
+			while (nf)
 			{
 				AutoPtr<JobNotification> jn = nf.cast<JobNotification>();
-				if (!jn) 
-				{
+				AutoPtr<CancelNotification> cn = nf.cast<CancelNotification>();
+				if (jn)
+					accept(jn->job);
+				else if (cn)
+					drop(cn->job);
+				else
 					_logger.warning("Unexpected notification type in sendQ");
-					continue;
-				}
+				nf = _sendQ.dequeueNotification();
+			}
 
-				JobPtr job = jn->job;	
-				_logger.information("Sender got job: %s=[%s], printers=%z",
-					job->formatLabel, job->outputPath, job->printers.size());
-				
+			retry();
+			dispatch();
+			if (!_transfers.empty())
+				poll();
 
-				std::vector<std::unique_ptr<SendRunnable>> runners;
-				std::vector<std::unique_ptr<Poco::Thread>> threads;
-				runners.reserve(job->printers.size());
-				threads.reserve(job->printers.size());
+			// a single-session printer port stays blocked while an idle connection holds it
+			if (_lastSweep.isElapsed(Timespan::SECONDS))
+			{
+				_printerPool.expire();
+				_lastSweep.update();
+			}
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.error(ex.displayText());
+		}
+		catch (std::exception& ex)
+		{
+			_logger.error(ex.what());
+		}
+	}
 
-				for (size_t i = 0; i < job->printers.size(); ++i) 
-				{
-					runners.emplace_back(new SendRunnable(_logger, job->outputPath, job->printers[i], _readonly));
-					threads.emplace_back(std::make_unique<Poco::Thread>());
-					threads.back()->start(*runners.back());
-					_logger.information("Printing Job started to %s", job->printers[i]);
-				}
-				
-				bool allOk = true;
-				for (size_t i = 0; i < threads.size(); ++i) 
-				{
-					threads[i]->join();
-					if (!runners[i]->ok()) 
-					{
-						_logger.error("Failed sending to %s", job->printers[i]);
-						allOk = false;
-					}
-				}
+	// unfinished deliveries are not failures: the journal still
+	// holds them and they are resumed after a restart
+	if (_journal.enabled())
+	{
+		for (auto& t : _transfers)
+		{
+			::close(t.second->fd);
+			t.second->socket.close();
+		}
+		_transfers.clear();
+		return;
+	}
+
+	// without a journal nothing resumes them, they are settled as failed
+	// and so end up in the dead letter spool, from where they can be replayed
+	while (!_transfers.empty())
+		complete(_transfers.begin(), false, "shutdown");
+	std::vector<Delivery> waiting = _retries.removeIf([](const Delivery&) { return true; });
+	for (auto& q : _queues)
+		waiting.insert(waiting.end(), q.second.pending.begin(), q.second.pending.end());
+	_queues.clear();
+	for (const auto& d : waiting)
+		settle(d, false, "shutdown");
+}
+
+void GSSenderTask::accept(const JobPtr& job)
+{
+	_logger.information("Sender got job: %s=[%s], printers=%z",
+		job->formatLabel, job->outputPath, job->printers.size());
+	job->setState(JOB_SENDING);
+	job->sendsPending = static_cast<int>(job->printers.size());
+
+	// cancelled while converting, after the worker looked for the last time
+	if (job->cancelled)
+	{
+		for (std::size_t i = 0; i < job->printers.size(); ++i)
+			settle(Delivery{job, i}, false, "cancelled");
+		return;
+	}
+
+	// every printer gets its own queue, a slow or offline
+	// printer only holds back the jobs queued for itself
+	for (std::size_t i = 0; i < job->printers.size(); ++i)
+		_queues[job->printers[i]].pending.push_back(Delivery{job, i});
+}
+
+void GSSenderTask::drop(const JobPtr& job)
+{
+	// waiting deliveries never started, they are settled right here
+	std::vector<Delivery> dropped = _retries.removeIf([&job](const Delivery& d) { return d.job == job; });
+	for (auto& q : _queues)
+	{
+		std::deque<Delivery>& pending = q.second.pending;
+		for (auto it = pending.begin(); it != pending.end(); )
+		{
+			if (it->job == job)
+			{
+				dropped.push_back(*it);
+				it = pending.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+	for (const auto& d : dropped)
+		settle(d, false, "cancelled");
+
+	// transfers in flight are closed, complete() settles them
+	for (auto it = _transfers.begin(); it != _transfers.end(); )
+	{
+		auto next = std::next(it);
+		if (it->second->delivery.job == job)
+			complete(it, false, "cancelled");
+		it = next;
+	}
+}
+
+void GSSenderTask::dispatch()
+{
+	for (auto it = _queues.begin(); it != _queues.end(); )
+	{
+		PrinterQueue& queue = it->second;
+		while (!queue.pending.empty() && queue.active < _perPrinter && _active < _maxActive)
+		{
+			Delivery d = queue.pending.front();
+			queue.pending.pop_front();
+			++queue.active;
+			++_active;
+			start(d);
+		}
+		if (queue.active == 0 && queue.pending.empty())
+			it = _queues.erase(it);
+		else
+			++it;
+	}
+}
+
+void GSSenderTask::start(const Delivery& d)
+{
+	const std::string& file = d.job->outputPath;
+	const std::string& printer = d.job->printers[d.index];
 
-				// upon successfully printing, the files will be deleted 
-				// once disposal is true in properties file
-				if (allOk && _disposal) 
+	if (_readonly)
+	{
+		_logger.information("READONLY: Would send [%s] to [%s] ...", file, printer);
+		delivered(d, true, "");
+		return;
+	}
+
+	int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		_logger.error("File [%s] does not exist.", file);
+		GSMetrics::instance().sendFailed();
+		delivered(d, false, "output file does not exist", true);
+		return;
+	}
+
+	std::unique_ptr<Transfer> pTransfer(new Transfer);
+	pTransfer->delivery = d;
+	pTransfer->fd = fd;
+	pTransfer->zeroCopy = _sendfile;
+	try
+	{
+		if (!_printerPool.reuse(printer, pTransfer->socket))
+		{
+			pTransfer->socket.connectNB(SocketAddress(printer));
+			pTransfer->connecting = true;
+		}
+		pTransfer->socket.setBlocking(false);
+		_pollSet.add(pTransfer->socket, PollSet::POLL_WRITE | PollSet::POLL_ERROR);
+	}
+	catch (Poco::Exception& ex)
+	{
+		::close(fd);
+		pTransfer->socket.close();
+		GSMetrics::instance().sendFailed();
+		delivered(d, false, ex.displayText());
+		return;
+	}
+
+	_logger.information("Sending [%s] to [%s] ...", file, printer);
+	const poco_socket_t sockfd = pTransfer->socket.impl()->sockfd();
+	_transfers[sockfd] = std::move(pTransfer);
+}
+
+void GSSenderTask::poll()
+{
+	PollSet::SocketModeMap ready = _pollSet.poll(POLL_INTERVAL);
+	for (const auto& r : ready)
+	{
+		auto it = _transfers.find(r.first.impl()->sockfd());
+		if (it == _transfers.end())
+			continue;
+
+		Transfer& t = *it->second;
+		try
+		{
+			if (t.connecting || (r.second & PollSet::POLL_ERROR))
+			{
+				int err = t.socket.impl()->socketError();
+				if (err != 0)
+					throw NetException(Error::getMessage(err), err);
+				if (t.connecting)
 				{
-					try 
-					{
-
-						Poco::File(job->outputPath).remove();
-						Poco::File(job->inputPath).remove();
-						_logger.information("Deleted files [%s] and [%s]",
-							job->outputPath, job->inputPath);
-					}
-					catch (Poco::FileNotFoundException& ex)
-					{
-						_logger.error("File not found during cleanup: %s", ex.displayText());
-					}
-					catch (Poco::Exception& ex) 
-					{
-						_logger.error("Cleanup failed: %s", ex.displayText());
-					}
+					_printerPool.setup(t.socket);
+					t.connecting = false;
+					t.lastProgress.update();
 				}
 			}
+			if (pump(t))
+				complete(it, true, "");
 		}
 		catch (Poco::Exception& ex)
 		{
-			_logger.error(ex.displayText());
+			complete(it, false, ex.displayText());
 		}
-		catch (std::exception& ex)
+	}
+
+	// per-transfer timeouts: connecting counts from the start,
+	// sending from the last byte the printer accepted
+	const Timespan::TimeDiff connectTimeout = _printerPool.connectTimeout().totalMicroseconds();
+	const Timespan::TimeDiff sendTimeout = _printerPool.sendTimeout().totalMicroseconds();
+	for (auto it = _transfers.begin(); it != _transfers.end(); )
+	{
+		auto next = std::next(it);
+		const Transfer& t = *it->second;
+		if (t.connecting && t.started.isElapsed(connectTimeout))
+			complete(it, false, "connect timeout");
+		else if (!t.connecting && t.lastProgress.isElapsed(sendTimeout))
+			complete(it, false, "send timeout");
+		it = next;
+	}
+}
+
+bool GSSenderTask::pump(Transfer& t)
+{
+	const std::string& separator = _printerPool.jobSeparator();
+	std::size_t budget = PUMP_BUDGET;
+	while (budget > 0)
+	{
+		ssize_t n = 0;
+		if (t.stage == Transfer::BODY && t.zeroCopy)
 		{
-			_logger.error(ex.what());
+			off_t offset = static_cast<off_t>(t.offset);
+			n = ::sendfile(t.socket.impl()->sockfd(), t.fd, &offset, budget);
+			if (n < 0)
+			{
+				const int err = errno;
+				if (err == EAGAIN || err == EWOULDBLOCK)
+					return false;
+				if (err != EINVAL && err != ENOSYS && err != EOPNOTSUPP)
+					throw NetException(Error::getMessage(err), err);
+
+				// the file system cannot sendfile, copy through the buffer instead
+				_logger.debug("sendfile unavailable for [%s], copying", t.delivery.job->outputPath);
+				t.zeroCopy = false;
+				continue;
+			}
+			if (n == 0)
+			{
+				t.stage = Transfer::TAIL;
+				t.offset = 0;
+				continue;
+			}
 		}
+		else if (t.stage == Transfer::BODY)
+		{
+			// nothing is buffered per transfer: whatever the socket did not
+			// take is read again from the file offset next time
+			ssize_t r = ::pread(t.fd, _buffer.data(), std::min(_buffer.size(), budget), static_cast<off_t>(t.offset));
+			if (r < 0)
+				throw ReadFileException(t.delivery.job->outputPath, Error::getMessage(Error::last()));
+			if (r == 0)
+			{
+				t.stage = Transfer::TAIL;
+				t.offset = 0;
+				continue;
+			}
+			n = t.socket.sendBytes(_buffer.data(), static_cast<int>(r));
+		}
+		else if (t.stage == Transfer::HEAD || t.stage == Transfer::TAIL)
+		{
+			if (t.offset >= separator.size())
+			{
+				t.stage = (t.stage == Transfer::HEAD) ? Transfer::BODY : Transfer::DONE;
+				t.offset = 0;
+				continue;
+			}
+			n = t.socket.sendBytes(separator.data() + t.offset, static_cast<int>(separator.size() - t.offset));
+		}
+		else
+			return true;
+
+		// a non-blocking socket returns -1 when its send buffer is full
+		if (n < 0)
+			return false;
+		if (n == 0)
+			throw Poco::IOException("connection closed by printer");
+
+		t.offset += static_cast<Poco::UInt64>(n);
+		if (t.stage == Transfer::BODY)
+			t.bytes += static_cast<Poco::UInt64>(n);
+		budget -= std::min(budget, static_cast<std::size_t>(n));
+		t.lastProgress.update();
 	}
+	return false;
 }
 
+void GSSenderTask::complete(TransferMap::iterator it, bool ok, const std::string& error)
+{
+	std::unique_ptr<Transfer> pTransfer = std::move(it->second);
+	_transfers.erase(it);
+
+	const Delivery& d = pTransfer->delivery;
+	const std::string& printer = d.job->printers[d.index];
+	::close(pTransfer->fd);
+	try
+	{
+		_pollSet.remove(pTransfer->socket);
+		if (ok)
+		{
+			pTransfer->socket.setBlocking(true);
+			_printerPool.release(printer, pTransfer->socket);
+		}
+		else
+			pTransfer->socket.close();
+	}
+	catch (Poco::Exception& ex)
+	{
+		_logger.warning("Closing connection to %s: %s", printer, ex.displayText());
+	}
+
+	if (ok)
+	{
+		const double seconds = pTransfer->started.elapsed() / 1e6;
+		_logger.information("Sending [%s] to [%s] succesfully completed, %Lu bytes in %.2fs (%.0f bytes/s%s).",
+			d.job->outputPath, printer, pTransfer->bytes, seconds,
+			seconds > 0 ? static_cast<double>(pTransfer->bytes) / seconds : 0.0,
+			std::string(pTransfer->zeroCopy ? ", sendfile" : ""));
+		GSMetrics::instance().send(pTransfer->bytes, seconds);
+	}
+	else
+		GSMetrics::instance().sendFailed();
+
+	delivered(d, ok, error);
+}
+
+void GSSenderTask::delivered(const Delivery& d, bool ok, const std::string& error, bool permanent)
+{
+	const JobPtr& job = d.job;
+	const std::string& printer = job->printers[d.index];
+	const bool retrying = !ok && !permanent && d.attempt < _maxRetries && !isCancelled() && !job->cancelled;
+	if (retrying)
+	{
+		const Timespan delay = backoff(d.attempt);
+		_logger.warning("Failed sending to %s: %s, retry %d of %d in %.1fs",
+			printer, error, d.attempt + 1, _maxRetries, delay.totalMilliseconds() / 1e3);
+		job->setPrinterRetry(d.index, error);
+		_retries.schedule(Timestamp() + delay.totalMicroseconds(), Delivery{job, d.index, d.attempt + 1});
+		GSMetrics::instance().sendRetry();
+	}
+	else
+		settle(d, ok, error);
+
+	// emptied queues are dropped by the next dispatch
+	auto it = _queues.find(printer);
+	if (it != _queues.end())
+		--it->second.active;
+	--_active;
+}
+
+void GSSenderTask::settle(const Delivery& d, bool ok, const std::string& error)
+{
+	const JobPtr& job = d.job;
+	if (!ok)
+	{
+		job->sendsOk = false;
+		if (!job->cancelled)
+		{
+			_logger.error("Failed sending to %s: %s", job->printers[d.index], error);
+			_deadLetter.add(*job, d.index, error, d.attempt + 1);
+		}
+	}
+	job->setPrinterResult(d.index, ok, error);
+	_journal.sent(*job, d.index);
+
+	if (--job->sendsPending == 0)
+		finish(job);
+}
+
+void GSSenderTask::retry()
+{
+	// retried deliveries go ahead of the printer's queue, keeping its job order
+	std::vector<Delivery> due = _retries.expire(Timestamp());
+	for (auto it = due.rbegin(); it != due.rend(); ++it)
+		_queues[it->job->printers[it->index]].pending.push_front(*it);
+}
+
+Timespan GSSenderTask::backoff(int attempt)
+{
+	// exponential, capped, with jitter over the upper half so that deliveries
+	// failed together (a printer going down) do not all retry at once
+	Timespan::TimeDiff delay = _retryDelay.totalMicroseconds();
+	for (int i = 0; i < attempt && delay < _retryMaxDelay.totalMicroseconds(); ++i)
+		delay *= 2;
+	delay = std::min(delay, _retryMaxDelay.totalMicroseconds());
+	return Timespan(delay / 2 + static_cast<Timespan::TimeDiff>(_random.nextDouble() * static_cast<double>(delay / 2)));
+}
+
+void GSSenderTask::finish(const JobPtr& job)
+{
+	const bool allOk = job->sendsOk;
+	job->setState(job->cancelled ? JOB_CANCELLED : (allOk ? JOB_DONE : JOB_FAILED));
+	_journal.done(*job);
+
+	// upon successfully printing, the files will be deleted 
+	// once disposal is true in properties file; a replayed dead letter
+	// leaves them to the other printers of its job still dead lettered
+	if (allOk && _disposal && !_deadLetter.references(job->outputPath))
+	{
+		try 
+		{
+			Poco::File(job->outputPath).remove();
+			Poco::File(job->inputPath).remove();
+			_logger.information("Deleted files [%s] and [%s]",
+				job->outputPath, job->inputPath);
+		}
+		catch (Poco::FileNotFoundException& ex)
+		{
+			_logger.error("File not found during cleanup: %s", ex.displayText());
+		}
+		catch (Poco::Exception& ex) 
+		{
+			_logger.error("Cleanup failed: %s", ex.displayText());
+		}
+	}
+}
@@ -26,13 +26,45 @@
 #include "Poco/Task.h"
 #include "Poco/Logger.h"
 #include "Poco/NotificationQueue.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Timespan.h"
+#include "Poco/Random.h"
+#include "Poco/Net/PollSet.h"
+#include "Poco/Net/StreamSocket.h"
 #include "Poco/Util/LayeredConfiguration.h"
 #include "GSNotification.h"
+#include "GSPrinterPool.h"
+#include "GSDeadLetter.h"
+#include "GSJournal.h"
+#include "GSTimerWheel.h"
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 class GSSenderTask : public Poco::Task
+	/// Sends converted jobs to their printers from a single event loop.
+	///
+	/// Every transfer is a non-blocking socket in a PollSet (epoll on
+	/// Linux) that is fed from the output file whenever the printer can
+	/// take more data, so thousands of transfers cost one thread and no
+	/// per-transfer buffers. Connect and send timeouts are enforced per
+	/// transfer by the loop.
+	///
+	/// The file goes to the socket with sendfile(2), without passing through
+	/// user space; where that is not possible it is copied through a buffer.
+	///
+	/// A failed delivery is retried sender.retries times with exponential
+	/// backoff and jitter, parked on a timer wheel so other transfers go on.
+	/// Deliveries out of retries are spooled to the dead letter spool.
+	///
+	/// A CancelNotification in sendQ drops a job's queued and retrying
+	/// deliveries and closes its transfers in flight.
 {
 public:
-	GSSenderTask(Poco::NotificationQueue& sendQ, Poco::Logger& logger, Poco::Util::LayeredConfiguration& config);
+	GSSenderTask(Poco::NotificationQueue& sendQ, GSPrinterPool& printerPool, GSDeadLetter& deadLetter,
+		GSJournal& journal, Poco::Logger& logger, Poco::Util::LayeredConfiguration& config);
 	GSSenderTask(const GSSenderTask&) = delete;
 	GSSenderTask& operator=(const GSSenderTask&) = delete;
 	GSSenderTask(GSSenderTask&&) = delete;
@@ -43,11 +75,77 @@ public:
 	void runTask();
 
 private:
+	struct Delivery
+	{
+		JobPtr job;
+		std::size_t index;	// into job->printers
+		int attempt = 0;	// failed attempts so far
+	};
+
+	struct PrinterQueue
+	{
+		std::deque<Delivery> pending;
+		int active = 0;
+	};
+
+	struct Transfer
+	{
+		enum Stage
+		{
+			HEAD,	// job separator
+			BODY,	// output file
+			TAIL,	// job separator
+			DONE
+		};
+
+		Delivery delivery;
+		Poco::Net::StreamSocket socket;
+		int fd = -1;
+		bool connecting = false;
+		bool zeroCopy = false;		// sendfile, until the file system refuses
+		Stage stage = HEAD;
+		Poco::UInt64 offset = 0;	// into the current stage
+		Poco::UInt64 bytes = 0;		// of the output file sent
+		Poco::Timestamp started;
+		Poco::Timestamp lastProgress;
+	};
+
+	using TransferMap = std::map<poco_socket_t, std::unique_ptr<Transfer>>;
+
+	void accept(const JobPtr& job);
+	void drop(const JobPtr& job);
+	void dispatch();
+	void start(const Delivery& d);
+	void poll();
+	bool pump(Transfer& t);
+	void complete(TransferMap::iterator it, bool ok, const std::string& error);
+	void delivered(const Delivery& d, bool ok, const std::string& error, bool permanent = false);
+	void settle(const Delivery& d, bool ok, const std::string& error);
+	void retry();
+	Poco::Timespan backoff(int attempt);
+	void finish(const JobPtr& job);
 
 	Poco::Logger& _logger;
 	Poco::NotificationQueue& _sendQ;
+	GSPrinterPool& _printerPool;
+	GSDeadLetter& _deadLetter;
+	GSJournal& _journal;
 	bool _readonly;
 	bool _disposal;
+	bool _sendfile;
+	int _perPrinter;		// concurrent transfers per printer
+	int _maxActive;			// concurrent transfers overall
+	int _maxRetries;
+	Poco::Timespan _retryDelay;		// before the first retry, doubled for every further one
+	Poco::Timespan _retryMaxDelay;
+	GSTimerWheel<Delivery> _retries;
+	Poco::Random _random;
+	std::map<std::string, PrinterQueue> _queues;
+	int _active = 0;
+	Poco::Net::PollSet _pollSet;
+	TransferMap _transfers;		// by socket descriptor
+	std::vector<char> _buffer;	// shared by all transfers, refilled from the file offset
+	Poco::Timestamp _lastSweep;	// of the printer pool's idle connections
 };
 
 #endif // GSSenderTask_INCLUDED
@@ -22,6 +22,7 @@
 #include "Poco/Task.h"
 #include "Poco/AutoPtr.h"
 #include "Poco/Timespan.h"
+#include "Poco/Environment.h"
 #include "Poco/AsyncNotificationCenter.h"
 #include "Poco/LoggingFactory.h"
 #include "Poco/LoggingRegistry.h"
@@ -30,12 +31,28 @@
 #include "Poco/Util/OptionSet.h"
 #include "Poco/Util/HelpFormatter.h"
 #include "Poco/TaskManager.h"
+#include "Poco/ThreadPool.h"
 #include "Poco/Data/ODBC/Connector.h"
 #include "Poco/Util/ServerApplication.h"
 #include <iostream>
+#include <csignal>
 #include "GSHTTPTask.h"
 #include "GSWorkerTask.h"
 #include "GSSenderTask.h"
+#include "GSInstancePool.h"
+#include "GSResultCache.h"
+#include "GSJobTable.h"
+#include "GSPrinterPool.h"
+#include "GSAdmission.h"
+#include "GSScheduler.h"
+#include "GSDeadLetter.h"
+#include "GSJournal.h"
+#include "GSPresets.h"
+#include "GSRenderTuning.h"
+#include "GSPreflight.h"
+#include "GSMemoryBudget.h"
+#include "GSSubmission.h"
+#include "GSIngest.h"
 
 
 using namespace Poco;
@@ -67,6 +84,9 @@ protected:
 
 		ServerApplication::initialize(self);
 
+		// sendfile to a printer that hung up must fail with EPIPE, not kill the server
+		std::signal(SIGPIPE, SIG_IGN);
+
 		if (!_helpRequested)
 		{
 			logger().information(R"(
@@ -151,24 +171,55 @@ protected:
 	{
 		if (!_helpRequested)
 		{
-			NotificationQueue convQ;
+			GSScheduler scheduler(config());
 			NotificationQueue sendQ;
-			TaskManager tm;
+			GSInstancePool gsPool(config(), logger());
+			GSResultCache cache(config(), logger());
+			GSJobTable jobs(config());
+			GSPrinterPool printerPool(config(), logger());
+			GSAdmission admission(config(), logger());
+			GSDeadLetter deadLetter(config(), logger());
+			GSJournal journal(config(), logger());
+			GSPresets presets(config(), logger());
+			GSRenderTuning tuning(config(), logger());
+			GSMemoryBudget memory(config(), tuning, logger());
+			GSPreflight preflight(config(), logger());
+			GSSubmission submission(scheduler, sendQ, cache, jobs, admission, journal, presets, preflight, config());
+
+			// each worker owns its Ghostscript instance and takes jobs from the scheduler concurrently
+			int workers = config().getInt("workers.count", static_cast<int>(Poco::Environment::processorCount()));
+			if (workers < 1) workers = 1;
+
+			// the default pool tops out at 16 threads; size ours for HTTP + ingest + sender + workers
+			ThreadPool taskPool("GSTasks", 2, workers + 3);
+			TaskManager tm(taskPool);
 
 			GSHTTPTask* pGSHTTP = nullptr;
-			GSWorkerTask* pWorkerTask = nullptr;
 			GSSenderTask* pSenderTask = nullptr;
 
 
 			try
 			{
-				pGSHTTP = new GSHTTPTask(config(), convQ);
+				// jobs left unfinished by the last run go first
+				journal.recover(scheduler, sendQ, jobs, admission);
+
+				pGSHTTP = new GSHTTPTask(config(), scheduler, sendQ, cache, jobs, admission, deadLetter, journal, submission);
 				tm.start(pGSHTTP);
 
-				pWorkerTask = new GSWorkerTask(convQ, sendQ, logger(), config());
-				tm.start(pWorkerTask);
+				// slow uploads on their own port, read without a thread each
+				if (config().has("ingest.address"))
+					tm.start(new GSIngest(submission, logger(), config()));
+
+				// timeouts, DELETE and shutdown reach a running conversion through the poll callback only
+				if (!GSRenderControl::interruptible())
+					logger().warning("Ghostscript was built without CHECK_INTERRUPTS: render.timeout, DELETE /jobs/{id} "
+						"and shutdown cannot stop a running conversion, it always runs to its end.");
+
+				for (int i = 1; i <= workers; ++i)
+					tm.start(new GSWorkerTask(scheduler, sendQ, gsPool, cache, printerPool, admission, journal, tuning, memory, logger(), config(), i));
+				logger().information("Started %d conversion worker(s).", workers);
 
-				pSenderTask = new GSSenderTask(sendQ, logger(), config());
+				pSenderTask = new GSSenderTask(sendQ, printerPool, deadLetter, journal, logger(), config());
 				tm.start(pSenderTask);
 
 				std::string svcName = config().getString("service.name");
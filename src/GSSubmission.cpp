@@ -0,0 +1,651 @@
+//
+// GSSubmission.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "GSSubmission.h"
+#include "GSResultCache.h"
+#include "GSJobTable.h"
+#include "GSMetrics.h"
+#include "GSAdmission.h"
+#include "GSScheduler.h"
+#include "GSJournal.h"
+#include "GSPresets.h"
+#include "GSPreflight.h"
+
+#include "Poco/URI.h"
+#include "Poco/Path.h"
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/NumberParser.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/SHA1Engine.h"
+#include "Poco/DateTimeFormat.h"
+#include "Poco/DateTimeParser.h"
+#include "Poco/DateTime.h"
+#include "Poco/Timespan.h"
+#include "Poco/String.h"
+
+#include <algorithm>
+#include <cctype>
+#include <vector>
+
+
+using namespace Poco;
+using namespace Poco::Net;
+using namespace Poco::Util;
+
+
+GSSubmission::GSSubmission(GSScheduler& scheduler, Poco::NotificationQueue& sendQ, GSResultCache& cache, GSJobTable& jobs,
+		GSAdmission& admission, GSJournal& journal, const GSPresets& presets, const GSPreflight& preflight,
+		LayeredConfiguration& config) :
+	_scheduler(scheduler),
+	_sendQ(sendQ),
+	_cache(cache),
+	_jobs(jobs),
+	_admission(admission),
+	_journal(journal),
+	_presets(presets),
+	_preflight(preflight),
+	_dir(config.getString("filesDir")),
+	_syncTimeout(config.getInt("sync.timeout", 120) * 1000L),
+	_dedupContent(config.getBool("dedup.content", true)),
+	_logger(Poco::Logger::get("GSHTTP"))
+{
+}
+
+GSSubmission::~GSSubmission()
+{
+}
+
+JobPtr GSSubmission::open(const HTTPRequest& request, HTTPResponse& response, GSReply& reply)
+{
+	// Checking wether method is POST, if not respond as ERROR
+	if (request.getMethod() != HTTPRequest::HTTP_POST) 
+	{
+		answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Method not allowed. Use POST.");
+		return JobPtr();
+	}
+
+	_logger.debug("Incoming query: %s", request.getURI());
+
+	// Query Parse
+	Poco::URI uri(request.getURI());
+	Poco::URI::QueryParameters qp = uri.getQueryParameters();
+
+	JobPtr job = std::make_shared<Job>();
+	
+	std::string ext;						// pcl, jpg, png, ...
+	std::string device;						// pxlmono, pxlcolor, png16m, jpeg, ...
+	std::string baseName;
+	std::vector<std::string> printers;		// from print=ip:port, ip2:port, ...
+	std::vector<std::string> gsArgs;		// f.e. -q, -dNOPAUSE, -sDEVICE=pxlmono, sOutputFile= ...
+	const GSPreset* pPreset = nullptr;		// from preset=NAME, replaces device and switches
+
+	for (auto& kv : qp) 
+	{
+		const std::string& k = kv.first;
+		const std::string& v = kv.second;
+
+		_logger.debug("Query param: [%s] = [%s]", kv.first, kv.second);
+
+		if (Poco::icompare(k, "print") == 0) 
+		{
+			Poco::StringTokenizer st(v, ",;", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+			for (const auto& s : st) 
+				printers.push_back(s);
+			continue;
+		}
+		if (Poco::icompare(k, "stream") == 0)
+		{
+			bool stream = true;
+			if (!v.empty() && !Poco::NumberParser::tryParseBool(v, stream))
+			{
+				answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Invalid stream value");
+				return JobPtr();
+			}
+			job->stream = stream;
+			continue;
+		}
+		if (Poco::icompare(k, "mode") == 0)
+		{
+			if (Poco::icompare(v, "sync") == 0)
+				job->sync = true;
+			else if (!v.empty() && Poco::icompare(v, "async") != 0)
+			{
+				answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Invalid mode, use sync or async");
+				return JobPtr();
+			}
+			continue;
+		}
+		if (Poco::icompare(k, "priority") == 0)
+		{
+			if (!GSScheduler::parsePriority(v, job->priority))
+			{
+				answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Invalid priority, use urgent, high, normal or bulk");
+				return JobPtr();
+			}
+			continue;
+		}
+		if (Poco::icompare(k, "timeout") == 0)
+		{
+			if (!Poco::NumberParser::tryParse(v, job->timeout) || job->timeout <= 0)
+			{
+				answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Invalid timeout, use seconds");
+				return JobPtr();
+			}
+			continue;
+		}
+		if (Poco::icompare(k, "deadline") == 0)
+		{
+			if (!parseDeadline(v, job->deadline))
+			{
+				answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Invalid deadline, use seconds from now or an ISO 8601 time");
+				return JobPtr();
+			}
+			continue;
+		}
+		if (Poco::icompare(k, "preset") == 0)
+		{
+			pPreset = _presets.find(v);
+			if (!pPreset)
+			{
+				answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Unknown preset");
+				return JobPtr();
+			}
+			continue;
+		}
+		if(Poco::icompare(k, "sDEVICE") == 0)
+		{
+			device = v;
+			continue;
+		}
+		if (Poco::icompare(k, "sOutputFile") == 0 || Poco::icompare(k, "out") == 0)
+		{
+			baseName = Poco::Path(v).getFileName();
+			_logger.debug("Base name: %s", baseName);
+			continue;
+		}
+		// All the others are GS arg:
+		// without values: "-q", "-dNOPAUSE", "-dBATCH", "-dSAFER"
+		// with values:  "-sOutputFile=path/file.pdf", "-sDEVICE=pxlmono"
+		if (v.empty()) 
+			gsArgs.push_back("-" + k);
+		else
+			gsArgs.push_back("-" + k + "=" + v);
+	}
+
+	if (pPreset)
+	{
+		// a preset is complete, the request only names the job
+		if (!device.empty() || !gsArgs.empty())
+		{
+			answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Ghostscript switches cannot be combined with a preset");
+			return JobPtr();
+		}
+		device = pPreset->device;
+	}
+	else if (_presets.only())
+	{
+		answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Missing preset, Ghostscript switches are not accepted");
+		return JobPtr();
+	}
+
+	if(device.empty())
+	{
+		answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Missing device name");
+		return JobPtr();
+	}
+
+	if(baseName.empty())
+	{
+		answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Missing file name");
+		return JobPtr();
+	}
+
+	// someone is waiting on the connection, go ahead of the batch jobs
+	if (job->sync)
+		job->priority = PRIORITY_URGENT;
+
+	if (job->sync && baseName.find('%') != std::string::npos)
+	{
+		answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Per-page output cannot be returned in sync mode");
+		return JobPtr();
+	}
+
+	Poco::File(Poco::Path(Poco::Path::forDirectory(_dir))).createDirectories();
+
+	// extension determination
+	ext = pPreset ? pPreset->extension : GSPresets::extension(device);
+	if(ext.empty())
+	{
+		answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Extenstion not supported");
+		return JobPtr();
+	}
+
+	// outputPath
+	Poco::Path outputPath(_dir, baseName + "." + ext); 
+	job->outputPath = outputPath.toString();
+
+	// -sDEVICE, -sOutputFile and the input path are appended by the
+	// worker, which may still redirect the output into its own directory
+	job->device = device;
+
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::toupper);
+	job->formatLabel = ext;  // PCL, PDF, JPG, ...
+	if (pPreset)
+		job->gsArgs = pPreset->gsArgs;
+	else
+		job->gsArgs = std::move(gsArgs);
+	job->printers = std::move(printers);
+
+	// 2) (Opcional) receive PDF body and store it on the location -> outputFile
+	bool hasBody = (request.getContentLength() != HTTPMessage::UNKNOWN_CONTENT_LENGTH && request.getContentLength() > 0);
+	if (!hasBody) 
+	{
+		answer(response, reply, HTTPResponse::HTTP_BAD_REQUEST, "Missing PDF body");
+		return JobPtr();
+	}
+
+	// decided on the headers alone, a rejected upload is never read
+	const Poco::UInt64 contentLength = request.getContentLength() > 0 ? static_cast<Poco::UInt64>(request.getContentLength()) : 0;
+	if (!_admission.admit(*job, contentLength))
+	{
+		// the connection is closed instead, so the upload is never transferred
+		response.set("Retry-After", Poco::NumberFormatter::format(_admission.retryAfter()));
+		response.setKeepAlive(false);
+		answer(response, reply, HTTPResponse::HTTP_SERVICE_UNAVAILABLE, "Server busy, retry later");
+		return JobPtr();
+	}
+
+	// from here on the job can be looked up, whatever the outcome
+	_jobs.add(job);
+	job->setState(JOB_RECEIVED);
+	response.set("X-Job-Id", job->jobId);
+
+	// the upload is named after the job, so concurrent requests
+	// for the same output name never overwrite each other's input
+	job->inputPath = Poco::Path(_dir, baseName + "." + job->jobId + ".pdf").toString();
+
+	// a retry carrying the same Idempotency-Key joins the job instead of repeating it
+	const std::string idempotencyKey = request.get("Idempotency-Key", "");
+	if (!idempotencyKey.empty())
+	{
+		// until the upload is complete a retry takes the key over, the upload may still fail
+		JobPtr original = _jobs.join("key:" + idempotencyKey, job, true, true);
+		if (original)
+		{
+			if (!sameRequest(*original, *job))
+			{
+				dropDuplicate(job);
+				response.erase("X-Job-Id");
+				answer(response, reply, HTTPResponse::HTTP_UNPROCESSABLE_ENTITY, "Idempotency-Key already used for a different job");
+				return JobPtr();
+			}
+			joinJob(job, original, response, reply);
+			return JobPtr();
+		}
+	}
+	return job;
+}
+
+std::string GSSubmission::partPath(const Job& job)
+{
+	// renamed into place once complete: a job using the
+	// input path meanwhile never sees a partial upload
+	return job.inputPath + ".part";
+}
+
+void GSSubmission::close(const JobPtr& job, Poco::UInt64 bytes, const std::string& digest, HTTPResponse& response, GSReply& reply)
+{
+	GSMetrics::instance().upload(bytes);
+
+	// a retry came while this upload ran and took its Idempotency-Key over
+	if (!job->dedupKey.empty())
+	{
+		JobPtr retry = _jobs.uploaded(job->dedupKey, job);
+		if (retry)
+		{
+			removeFile(partPath(*job));
+			if (!sameRequest(*retry, *job))
+			{
+				dropDuplicate(job);
+				response.erase("X-Job-Id");
+				answer(response, reply, HTTPResponse::HTTP_UNPROCESSABLE_ENTITY, "Idempotency-Key already used for a different job");
+				return;
+			}
+			joinJob(job, retry, response, reply);
+			return;
+		}
+	}
+
+	if (_cache.enabled())
+		job->cacheKey = GSResultCache::makeKey(digest, job->device, job->gsArgs, job->outputPath);
+
+	// the same document to the same output and printers, still in flight; this job
+	// takes the key only once journaled, no duplicate may join a job refused below
+	std::string key;
+	if (job->dedupKey.empty() && _dedupContent)
+	{
+		key = contentKey(digest, *job);
+		JobPtr original = _jobs.holder(key, false);
+		if (original)
+		{
+			removeFile(partPath(*job));
+			joinJob(job, original, response, reply);
+			return;
+		}
+	}
+	Poco::File(partPath(*job)).renameTo(job->inputPath);
+
+	// 4) Enqueue in the print queue, or straight in the send queue on a cache hit
+	const bool hit = !job->cacheKey.empty() && _cache.fetch(job->cacheKey, job->outputPath);
+	if (hit)
+	{
+		_logger.information("PDF->%s cache hit: %s", job->formatLabel, job->outputPath);
+		_admission.release(*job);
+		job->setState(JOB_CONVERTED);
+		if (!_journal.queued(*job))
+		{
+			refuse(job, response, reply);
+			return;
+		}
+		_journal.converted(*job);
+		if (!key.empty())
+			_jobs.join(key, job, false);
+		job->converted.set();
+		if (!job->sync && !job->printers.empty())
+			_sendQ.enqueueNotification(new JobNotification(job));
+		else if (!job->sync)
+		{
+			job->setState(JOB_DONE);
+			_journal.done(*job);
+		}
+	}
+	else
+	{
+		if (_preflight.enabled())
+		{
+			const GSPreflightResult pf = _preflight.check(job->inputPath);
+			if (!pf.ok)
+			{
+				reject(job, "Invalid PDF: " + pf.error, response, reply);
+				return;
+			}
+			_admission.reestimate(*job, GSAdmission::estimate(job->device, job->gsArgs, bytes, pf));
+			job->mediaWidth = pf.width;
+			job->mediaHeight = pf.height;
+		}
+
+		job->syncPending = job->sync;
+		job->setState(JOB_QUEUED);
+		if (!_journal.queued(*job))
+		{
+			refuse(job, response, reply);
+			return;
+		}
+		// a duplicate that took the key meanwhile runs on its own
+		if (!key.empty())
+			_jobs.join(key, job, false);
+		_scheduler.enqueue(job);
+	}
+
+	if (job->sync)
+	{
+		// a cached output is there already, a conversion is waited for by the caller
+		if (hit)
+			sendOutput(job, response, reply);
+		else
+			reply.pSync = job;
+		return;
+	}
+
+	// 5) Response to HTTP client
+	answer(response, reply, HTTPResponse::HTTP_OK,
+		"OK enqueued " + Poco::NumberFormatter::format(job->printers.size()) + " job(s), id " + job->jobId);
+}
+
+void GSSubmission::abort(const JobPtr& job)
+{
+	if (!job)
+		return;
+	removeFile(partPath(*job));
+	bool queued;
+	{
+		Poco::FastMutex::ScopedLock lock(job->statusMutex);
+		queued = job->state != JOB_RECEIVED;
+	}
+	if (!queued)
+	{
+		_admission.release(*job);
+		job->setState(JOB_FAILED);
+		job->converted.set();
+	}
+}
+
+void GSSubmission::sendOutput(const JobPtr& job, HTTPResponse& response, GSReply& reply)
+	/// Opens the output of a converted sync job as the response body.
+{
+	reply.pOutput.reset(new Poco::FileInputStream(job->outputPath));
+
+	// the output is open, printing (and disposal) may start now
+	if (!job->printers.empty())
+		_sendQ.enqueueNotification(new JobNotification(job));
+	else
+	{
+		job->setState(JOB_DONE);
+		_journal.done(*job);
+	}
+
+	response.setStatusAndReason(HTTPResponse::HTTP_OK);
+	response.setContentType(mapContentType(job->formatLabel));
+}
+
+void GSSubmission::joinJob(const JobPtr& job, const JobPtr& original, HTTPResponse& response, GSReply& reply)
+	/// Answers a duplicate request with the job it repeats: its ID,
+	/// and in sync mode (see wait()) its output once converted.
+{
+	_logger.information("Request for %s joined job %s", job->outputPath, original->jobId);
+	GSMetrics::instance().joined();
+	dropDuplicate(job);
+	response.set("X-Job-Id", original->jobId);
+	response.set("X-Job-Joined", "true");
+
+	if (job->sync)
+		reply.pJoined = original;
+	else
+		answer(response, reply, HTTPResponse::HTTP_OK, "OK joined job " + original->jobId);
+}
+
+void GSSubmission::wait(HTTPResponse& response, GSReply& reply)
+{
+	const JobPtr job = awaited(reply);
+	if (job)
+		settle(response, reply, !job->converted.tryWait(_syncTimeout));
+}
+
+JobPtr GSSubmission::awaited(const GSReply& reply)
+{
+	return reply.pSync ? reply.pSync : reply.pJoined;
+}
+
+Poco::Timespan GSSubmission::syncTimeout() const
+{
+	return Poco::Timespan(_syncTimeout * Poco::Timespan::MILLISECONDS);
+}
+
+void GSSubmission::settle(HTTPResponse& response, GSReply& reply, bool timedOut)
+{
+	if (reply.pSync)
+	{
+		const JobPtr job = std::move(reply.pSync);
+		if (timedOut)
+		{
+			// if the worker finished in the meantime it left the job to us
+			if (job->syncPending.exchange(false))
+			{
+				_logger.warning("Sync conversion of %s timed out, continuing in background", job->outputPath);
+				answer(response, reply, HTTPResponse::HTTP_GATEWAY_TIMEOUT, "Conversion timed out, job continues in background");
+				return;
+			}
+			job->converted.wait();
+		}
+		if (!job->convertedOk)
+		{
+			answer(response, reply, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, "Conversion failed");
+			return;
+		}
+		sendOutput(job, response, reply);
+		return;
+	}
+
+	if (!reply.pJoined)
+		return;
+	const JobPtr original = std::move(reply.pJoined);
+	if (timedOut)
+	{
+		answer(response, reply, HTTPResponse::HTTP_GATEWAY_TIMEOUT, "Conversion timed out, job " + original->jobId + " continues in background");
+		return;
+	}
+	JobState state;
+	{
+		Poco::FastMutex::ScopedLock lock(original->statusMutex);
+		state = original->state;
+	}
+	if (state != JOB_CONVERTED && state != JOB_SENDING && state != JOB_DONE)
+	{
+		answer(response, reply, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, std::string("Conversion ") + jobStateName(state));
+		return;
+	}
+
+	try
+	{
+		reply.pOutput.reset(new Poco::FileInputStream(original->outputPath));
+	}
+	catch (Poco::FileException&)
+	{
+		// printed and disposed of in the meantime
+		answer(response, reply, HTTPResponse::HTTP_GONE, "Output of job " + original->jobId + " no longer available");
+		return;
+	}
+	response.setStatusAndReason(HTTPResponse::HTTP_OK);
+	response.setContentType(mapContentType(original->formatLabel));
+}
+
+void GSSubmission::dropDuplicate(const JobPtr& job)
+	/// The request's own job never runs.
+{
+	_admission.release(*job);
+	_jobs.remove(job->jobId);
+}
+
+void GSSubmission::reject(const JobPtr& job, const std::string& message, HTTPResponse& response, GSReply& reply)
+	/// A stored upload that failed the preflight: it never reaches a worker.
+{
+	_logger.warning("Rejected job %s: %s", job->jobId, message);
+	GSMetrics::instance().preflightRejected();
+	_admission.release(*job);
+	job->setState(JOB_FAILED);
+	job->converted.set();
+	removeFile(job->inputPath);
+	answer(response, reply, HTTPResponse::HTTP_UNPROCESSABLE_ENTITY, message);
+}
+
+void GSSubmission::refuse(const JobPtr& job, HTTPResponse& response, GSReply& reply)
+	/// The job could not be journaled: acknowledging it would promise
+	/// more than a restart keeps.
+{
+	_logger.error("Job %s not accepted, its journal record could not be written", job->jobId);
+	_admission.release(*job);
+	job->setState(JOB_FAILED);
+	job->converted.set();
+	removeFile(job->inputPath);
+	response.set("Retry-After", Poco::NumberFormatter::format(_admission.retryAfter()));
+	answer(response, reply, HTTPResponse::HTTP_SERVICE_UNAVAILABLE, "Journal unavailable, retry later");
+}
+
+bool GSSubmission::parseDeadline(const std::string& value, Poco::Timestamp::TimeVal& deadline)
+	/// Seconds from now, or an absolute ISO 8601 time.
+{
+	int seconds = 0;
+	if (Poco::NumberParser::tryParse(value, seconds))
+	{
+		if (seconds < 0)
+			return false;
+		deadline = Poco::Timestamp().epochMicroseconds() + seconds * Poco::Timestamp::TimeDiff(Poco::Timespan::SECONDS);
+		return true;
+	}
+	Poco::DateTime dt;
+	int tzd = 0;
+	if (!Poco::DateTimeParser::tryParse(Poco::DateTimeFormat::ISO8601_FORMAT, value, dt, tzd) &&
+		!Poco::DateTimeParser::tryParse(Poco::DateTimeFormat::ISO8601_FRAC_FORMAT, value, dt, tzd))
+		return false;
+	dt.makeUTC(tzd);
+	deadline = dt.timestamp().epochMicroseconds();
+	return true;
+}
+
+bool GSSubmission::sameRequest(const Job& a, const Job& b)
+{
+	return a.device == b.device && a.gsArgs == b.gsArgs && a.outputPath == b.outputPath && a.printers == b.printers;
+}
+
+std::string GSSubmission::contentKey(const std::string& digest, const Job& job)
+{
+	Poco::SHA1Engine sha1;
+	sha1.update(GSResultCache::makeKey(digest, job.device, job.gsArgs, job.outputPath));
+	sha1.update('\0');
+	sha1.update(job.outputPath);
+	for (const auto& p : job.printers)
+	{
+		sha1.update('\0');
+		sha1.update(p);
+	}
+	return "content:" + Poco::DigestEngine::digestToHex(sha1.digest());
+}
+
+std::string GSSubmission::mapContentType(const std::string& label)
+{
+	if (label == "PCL")
+		return "application/vnd.hp-PCL";
+	if (label == "PNG")
+		return "image/png";
+	if (label == "JPG")
+		return "image/jpeg";
+	return "application/octet-stream";
+}
+
+void GSSubmission::removeFile(const std::string& path)
+{
+	try
+	{
+		Poco::File(path).remove();
+	}
+	catch (Poco::Exception&)
+	{
+	}
+}
+
+void GSSubmission::answer(HTTPResponse& response, GSReply& reply, HTTPResponse::HTTPStatus status, const std::string& text)
+{
+	response.setStatusAndReason(status);
+	response.setContentType("text/plain");
+	reply.text = text + "\n";
+}
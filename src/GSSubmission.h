@@ -0,0 +1,146 @@
+//
+// GSSubmission.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSSubmission_INCLUDED
+#define GSSubmission_INCLUDED
+
+
+#include "Poco/Logger.h"
+#include "Poco/NotificationQueue.h"
+#include "Poco/Timespan.h"
+#include "Poco/Net/HTTPRequest.h"
+#include "Poco/Net/HTTPResponse.h"
+#include "Poco/Util/LayeredConfiguration.h"
+#include "GSNotification.h"
+#include <istream>
+#include <memory>
+#include <string>
+
+
+class GSScheduler;
+class GSResultCache;
+class GSJobTable;
+class GSAdmission;
+class GSJournal;
+class GSPresets;
+class GSPreflight;
+
+
+struct GSReply
+	/// The answer to a conversion request apart from status and headers,
+	/// which go on the HTTPResponse: a line of text, or in sync mode the
+	/// converted output, opened before the printers may dispose of it.
+{
+	std::string text;
+	std::unique_ptr<std::istream> pOutput;
+	JobPtr pSync;		// sync job still converting: answered with its output, see GSSubmission::wait()
+	JobPtr pJoined;		// sync duplicate: answered with this job's output, see GSSubmission::wait()
+};
+
+
+class GSSubmission
+	/// Turns a conversion request into a queued job, for the threaded
+	/// HTTP handler and the upload reactor (GSIngest) alike.
+	///
+	/// open() decides on the request head alone: query, preset, admission
+	/// and Idempotency-Key. The caller then stores the body in partPath()
+	/// while hashing it, and close() joins the job to an identical one in
+	/// flight or queues it. In sync mode the reply then waits for the
+	/// conversion: wait() blocks for it, an event loop can poll awaited()
+	/// instead and finish with settle().
+	///
+	/// Both answer through the response and reply passed in. A caller that
+	/// fails between open() and close(), or catches an exception from
+	/// close(), settles the job with abort().
+{
+public:
+	GSSubmission(GSScheduler& scheduler, Poco::NotificationQueue& sendQ, GSResultCache& cache, GSJobTable& jobs,
+		GSAdmission& admission, GSJournal& journal, const GSPresets& presets, const GSPreflight& preflight,
+		Poco::Util::LayeredConfiguration& config);
+	GSSubmission(const GSSubmission&) = delete;
+	GSSubmission& operator=(const GSSubmission&) = delete;
+
+	~GSSubmission();
+
+	JobPtr open(const Poco::Net::HTTPRequest& request, Poco::Net::HTTPResponse& response, GSReply& reply);
+		/// Returns the admitted job waiting for its body, or an empty pointer
+		/// if the request is answered already. The body is not needed then;
+		/// with keep-alive off it was not even wanted (503).
+
+	static std::string partPath(const Job& job);
+		/// Where the body goes until it is complete.
+
+	void close(const JobPtr& job, Poco::UInt64 bytes, const std::string& digest,
+		Poco::Net::HTTPResponse& response, GSReply& reply);
+		/// Takes the complete body with its SHA-1 (hex) and answers the request.
+
+	void wait(Poco::Net::HTTPResponse& response, GSReply& reply);
+		/// Completes the reply of a sync request by waiting for the
+		/// conversion, up to sync.timeout. Does nothing for other replies.
+		/// open() and close() never wait for a conversion, this may.
+
+	static JobPtr awaited(const GSReply& reply);
+		/// The job whose conversion the reply waits for, if any.
+
+	void settle(Poco::Net::HTTPResponse& response, GSReply& reply, bool timedOut);
+		/// Completes a waiting reply once the awaited job's converted event
+		/// is set, or with timedOut (504) when it took too long. Does not
+		/// wait, apart from the moment a worker may still need to hand a
+		/// finished job over.
+
+	Poco::Timespan syncTimeout() const;
+
+	void abort(const JobPtr& job);
+		/// The body never arrived or could not be stored: gives back the
+		/// share of the backlog of a job not yet queued, marks it failed
+		/// and removes the partial upload.
+
+private:
+	void sendOutput(const JobPtr& job, Poco::Net::HTTPResponse& response, GSReply& reply);
+	void joinJob(const JobPtr& job, const JobPtr& original, Poco::Net::HTTPResponse& response, GSReply& reply);
+	void dropDuplicate(const JobPtr& job);
+	void reject(const JobPtr& job, const std::string& message, Poco::Net::HTTPResponse& response, GSReply& reply);
+	void refuse(const JobPtr& job, Poco::Net::HTTPResponse& response, GSReply& reply);
+
+	static bool parseDeadline(const std::string& value, Poco::Timestamp::TimeVal& deadline);
+	static bool sameRequest(const Job& a, const Job& b);
+	static std::string contentKey(const std::string& digest, const Job& job);
+	static std::string mapContentType(const std::string& label);
+	static void removeFile(const std::string& path);
+	static void answer(Poco::Net::HTTPResponse& response, GSReply& reply, Poco::Net::HTTPResponse::HTTPStatus status,
+		const std::string& text);
+
+	GSScheduler& _scheduler;
+	Poco::NotificationQueue& _sendQ;
+	GSResultCache& _cache;
+	GSJobTable& _jobs;
+	GSAdmission& _admission;
+	GSJournal& _journal;
+	const GSPresets& _presets;
+	const GSPreflight& _preflight;
+	std::string _dir;
+	long _syncTimeout;	// ms
+	bool _dedupContent;	// join identical uploads without an Idempotency-Key
+	Poco::Logger& _logger;
+};
+
+
+#endif // GSSubmission_INCLUDED
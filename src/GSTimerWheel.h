@@ -0,0 +1,135 @@
+//
+// GSTimerWheel.h
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef GSTimerWheel_INCLUDED
+#define GSTimerWheel_INCLUDED
+
+
+#include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Types.h"
+#include <utility>
+#include <vector>
+
+
+template <class T>
+class GSTimerWheel
+	/// Hashed timing wheel. A timer goes into one of a fixed number of
+	/// slots by its due tick, so scheduling and expiring cost the same
+	/// however many timers are pending. Timers fire up to one tick late.
+	///
+	/// Not thread safe; meant to be driven from a single event loop.
+{
+public:
+	explicit GSTimerWheel(const Poco::Timespan& tick = Poco::Timespan(0, 100000), std::size_t slots = 512) :
+		_tick(tick.totalMicroseconds() > 0 ? tick.totalMicroseconds() : 1),
+		_slots(slots > 0 ? slots : 1)
+	{
+	}
+
+	void schedule(const Poco::Timestamp& due, T item)
+	{
+		Poco::UInt64 tick = _current + 1;
+		const Poco::Timestamp::TimeDiff offset = due - _origin;
+		if (offset > 0)
+		{
+			const Poco::UInt64 dueTick = static_cast<Poco::UInt64>((offset + _tick - 1) / _tick);
+			if (dueTick > tick)
+				tick = dueTick;
+		}
+		_slots[tick % _slots.size()].push_back(Timer{tick, std::move(item)});
+		++_size;
+	}
+
+	std::vector<T> expire(const Poco::Timestamp& now)
+		/// Removes and returns the timers due by now.
+	{
+		std::vector<T> expired;
+		const Poco::Timestamp::TimeDiff elapsed = now - _origin;
+		const Poco::UInt64 target = elapsed > 0 ? static_cast<Poco::UInt64>(elapsed / _tick) : 0;
+		while (_current < target && _size > 0)
+		{
+			++_current;
+			std::vector<Timer>& slot = _slots[_current % _slots.size()];
+			for (std::size_t i = 0; i < slot.size(); )
+			{
+				// timers further out than one revolution wait for a later round
+				if (slot[i].tick <= _current)
+				{
+					expired.push_back(std::move(slot[i].item));
+					if (i + 1 != slot.size())
+						slot[i] = std::move(slot.back());
+					slot.pop_back();
+					--_size;
+				}
+				else
+					++i;
+			}
+		}
+		if (_current < target)
+			_current = target;
+		return expired;
+	}
+
+	template <class Predicate>
+	std::vector<T> removeIf(Predicate pred)
+		/// Removes and returns the pending timers the predicate matches.
+		/// Visits every timer, meant for rare events like a cancellation.
+	{
+		std::vector<T> removed;
+		for (auto& slot : _slots)
+		{
+			for (std::size_t i = 0; i < slot.size(); )
+			{
+				if (pred(slot[i].item))
+				{
+					removed.push_back(std::move(slot[i].item));
+					if (i + 1 != slot.size())
+						slot[i] = std::move(slot.back());
+					slot.pop_back();
+					--_size;
+				}
+				else
+					++i;
+			}
+		}
+		return removed;
+	}
+
+	std::size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+
+private:
+	struct Timer
+	{
+		Poco::UInt64 tick;
+		T item;
+	};
+
+	Poco::Timestamp::TimeDiff _tick;
+	std::vector<std::vector<Timer>> _slots;
+	Poco::Timestamp _origin;
+	Poco::UInt64 _current = 0;	// last tick expired
+	std::size_t _size = 0;
+};
+
+
+#endif // GSTimerWheel_INCLUDED
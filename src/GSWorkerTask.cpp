@@ -21,13 +21,29 @@
 
 #include "GSWorkerTask.h"
 #include "GSNotification.h"
+#include "GSPrinterStream.h"
+#include "GSMetrics.h"
+#include "GSPresets.h"
 
 #include "Poco/Notification.h"
 #include "Poco/NotificationQueue.h"
 #include "Poco/Logger.h"
+#include "Poco/Path.h"
+#include "Poco/File.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/String.h"
+#include "Poco/Thread.h"
+#include "Poco/Environment.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Timespan.h"
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
 
 #include "iapi.h"
 #include "ierrors.h"
@@ -37,15 +53,92 @@ using namespace Poco;
 using namespace Poco::Util;
 
 
+namespace
+{
+	int GSDLLCALL captureStdout(void* handle, const char* str, int len)
+	{
+		static_cast<std::string*>(handle)->append(str, static_cast<std::size_t>(len));
+		return len;
+	}
+
+	int GSDLLCALL pollControl(void* handle)
+	{
+		return static_cast<GSRenderControl*>(handle)->check();
+	}
+
+	std::string psString(const std::string& s)
+	{
+		std::string r;
+		r.reserve(s.size() + 2);
+		for (char c : s)
+		{
+			if (c == '(' || c == ')' || c == '\\')
+				r += '\\';
+			r += c;
+		}
+		return r;
+	}
+
+	bool splitPagePattern(const std::string& path, std::string& prefix, std::string& suffix, int& width, bool& zeroPad)
+		/// Splits a gs per-page output name like "label-%03d.png".
+	{
+		std::string::size_type pos = path.find('%');
+		if (pos == std::string::npos)
+			return false;
+
+		std::string::size_type i = pos + 1;
+		zeroPad = (i < path.size() && path[i] == '0');
+		width = 0;
+		while (i < path.size() && std::isdigit(static_cast<unsigned char>(path[i])))
+			width = width * 10 + (path[i++] - '0');
+		if (i >= path.size() || path[i] != 'd')
+			return false;
+
+		prefix = path.substr(0, pos);
+		suffix = path.substr(i + 1);
+		return suffix.find('%') == std::string::npos;
+	}
+
+	std::string pagePath(const std::string& prefix, const std::string& suffix, int width, bool zeroPad, int page)
+	{
+		return prefix + (zeroPad ? Poco::NumberFormatter::format0(page, width) : Poco::NumberFormatter::format(page, width)) + suffix;
+	}
+}
+
 
-GSWorkerTask::GSWorkerTask(Poco::NotificationQueue& convQ, Poco::NotificationQueue& sendQ, 
-		Poco::Logger& logger, Poco::Util::LayeredConfiguration& config) :
-	Task("GSWorkerTask"),
-	_convQ(convQ),
+
+GSWorkerTask::GSWorkerTask(GSScheduler& scheduler, Poco::NotificationQueue& sendQ, GSInstancePool& gsPool,
+		GSResultCache& cache, GSPrinterPool& printerPool, GSAdmission& admission, GSJournal& journal, GSRenderTuning& tuning,
+		GSMemoryBudget& memory, Poco::Logger& logger, Poco::Util::LayeredConfiguration& config, int workerId) :
+	Task("GSWorkerTask-" + Poco::NumberFormatter::format(workerId)),
+	_scheduler(scheduler),
 	_sendQ(sendQ),
+	_gsPool(gsPool),
+	_cache(cache),
+	_printerPool(printerPool),
+	_admission(admission),
+	_journal(journal),
+	_tuning(tuning),
+	_memory(memory),
 	_logger(logger),
-	_config(config)
+	_config(config),
+	_workerId(workerId),
+	_readonly(config.getBool("readonly", true)),
+	_disposal(config.getBool("disposal", false)),
+	_shardMinPages(config.getInt("shard.minPages", 0)),
+	_shardMinBytes(config.getInt64("shard.minBytes", 1024 * 1024)),
+	_shardCount(config.getInt("shard.count", static_cast<int>(Poco::Environment::processorCount()))),
+	_renderTimeout(config.getInt("render.timeout", 600))
 {
+	// every worker renders into its own directory, so two jobs with the
+	// same sOutputFile converted at the same time cannot clobber each other
+	if (_config.getBool("workers.separateOutputDirs", false))
+	{
+		Poco::Path dir(Poco::Path::forDirectory(_config.getString("filesDir")));
+		dir.pushDirectory("worker-" + Poco::NumberFormatter::format(_workerId));
+		Poco::File(dir).createDirectories();
+		_outputDir = dir.toString();
+	}
 }
 
 GSWorkerTask::~GSWorkerTask()
@@ -56,49 +149,456 @@ GSWorkerTask::~GSWorkerTask()
 void GSWorkerTask::runTask()
 {
 	while (!isCancelled())
+	{
+		JobPtr job;
+		try
+		{
+			job = _scheduler.waitDequeue(1000, &_memory);
+			if (job)
+				process(job);
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.error(ex.displayText());
+			if (job) fail(*job);
+		}
+		catch (std::exception& ex)
+		{
+			_logger.error(ex.what());
+			if (job) fail(*job);
+		}
+
+		// converted or not, the job no longer weighs on the backlog
+		if (job)
+			_admission.release(*job);
+
+		// jobs held back for memory may fit now
+		if (job && job->memory)
+		{
+			_memory.release(*job);
+			_scheduler.notify();
+		}
+
+		// a waiting sync request (or joined duplicate) must be released, whatever happened
+		if (job)
+			job->converted.set();
+	}
+}
+
+void GSWorkerTask::cancel()
+{
+	_stopping = true;
+	Task::cancel();
+}
+
+void GSWorkerTask::process(const JobPtr& job)
+{
+	// cancelled between the scheduler and here
+	if (job->cancelled)
+	{
+		_logger.information("Job %s cancelled before conversion", job->jobId);
+		job->setState(JOB_CANCELLED);
+		_journal.done(*job);
+		return;
+	}
+
+	job->setState(JOB_CONVERTING);
+	Poco::Timestamp started;
+	GSRenderControl control(job->cancelled, _stopping, renderDeadline(*job, started));
+
+	// streamed jobs go straight to the printers, the sender never sees them
+	if (job->stream && !job->sync && !job->printers.empty() && !_readonly)
+	{
+		bool streamed;
+		{
+			GSRenderTuning::Slot slot(_tuning, *job);
+			streamed = stream(*job, slot.params(), control);
+		}
+		if (aborted(*job, control, started.elapsed() / 1e6))
+			return;
+		GSMetrics::instance().conversion(job->device, streamed, started.elapsed() / 1e6);
+		if (streamed)
+		{
+			_logger.information("PDF->%s streamed to %z printer(s): %s", job->formatLabel, job->printers.size(), job->inputPath);
+			job->setState(JOB_DONE);
+		}
+		else
+		{
+			_logger.error("PDF->%s streaming failed for job %s", job->formatLabel, job->inputPath);
+			job->setState(JOB_FAILED);
+		}
+		_journal.done(*job);
+		return;
+	}
+
+	prepare(*job);
+	bool ok;
+	{
+		// the extra shard instances are shared by all workers, there may be none left,
+		// and every shard needs the job's memory again
+		GSInstancePool::Reservation reservation(_gsPool, shardCount(*job) - 1);
+		const int shards = _memory.widen(*job, 1 + reservation.count());
+		reservation.keep(shards - 1);
+		// shards are separate instances, each holds a thread and shares the grant
+		GSRenderTuning::Slot slot(_tuning, *job, shards);
+		ok = shards > 1 ? renderSharded(*job, shards, slot.params(), control) : render(*job, slot.params(), control);
+	}
+	if (aborted(*job, control, started.elapsed() / 1e6))
+		return;
+	GSMetrics::instance().conversion(job->device, ok, started.elapsed() / 1e6);
+	if (ok) 
+	{
+		_logger.information("PDF->%s done: %s", job->formatLabel, job->outputPath);
+		if (!job->cacheKey.empty() && job->outputPath.find('%') == std::string::npos)
+			_cache.store(job->cacheKey, job->outputPath);
+		job->setState(JOB_CONVERTED);
+		_journal.converted(*job);
+
+		// a still waiting sync request hands the job to the sender itself once
+		// the output is open, so disposal cannot delete it underneath
+		if (job->syncPending.exchange(false))
+			job->convertedOk = true;
+		else if(!job->printers.empty())
+		{
+			_sendQ.enqueueNotification(new JobNotification(job));
+		}
+		else
+		{
+			_logger.warning("No listed printer, conversion only");
+			job->setState(JOB_DONE);
+			_journal.done(*job);
+		}
+	} 
+	else 
+	{
+		_logger.error("PDF->%s failed for job %s", job->formatLabel, job->outputPath);
+		job->setState(JOB_FAILED);
+		_journal.done(*job);
+	}
+}
+
+void GSWorkerTask::fail(Job& job)
+{
+	GSMetrics::instance().conversionFailed(job.device);
+	job.setState(JOB_FAILED);
+	_journal.done(job);
+}
+
+bool GSWorkerTask::aborted(Job& job, const GSRenderControl& control, double seconds)
+{
+	switch (control.reason())
+	{
+	case GSRenderControl::RUNNING:
+		return false;
+	case GSRenderControl::STOPPED:
+		// neither done nor failed: the journal queues it again on startup
+		_logger.warning("Conversion of job %s interrupted by shutdown", job.jobId);
+		return true;
+	case GSRenderControl::CANCELLED:
+		_logger.information("Conversion of job %s cancelled after %.1fs", job.jobId, seconds);
+		job.setState(JOB_CANCELLED);
+		break;
+	case GSRenderControl::TIMED_OUT:
+		_logger.error("Conversion of job %s timed out after %.1fs", job.jobId, seconds);
+		GSMetrics::instance().conversion(job.device, false, seconds);
+		job.setState(JOB_FAILED);
+		break;
+	}
+	_journal.done(job);
+
+	// whatever the device got to write is of no use
+	if (!job.stream && job.outputPath.find('%') == std::string::npos)
 	{
 		try
 		{
-			if (Poco::Notification::Ptr nf = _convQ.waitDequeueNotification(1000)) 
+			Poco::File out(job.outputPath);
+			if (out.exists())
+				out.remove();
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.warning("Removing partial output: %s", ex.displayText());
+		}
+	}
+	return true;
+}
+
+Poco::Timestamp::TimeVal GSWorkerTask::renderDeadline(const Job& job, const Poco::Timestamp& started) const
+{
+	// a request may ask for less time than configured, never for more
+	int timeout = _config.getInt("render.timeout." + job.device, _renderTimeout);
+	if (job.timeout > 0 && (timeout <= 0 || job.timeout < timeout))
+		timeout = job.timeout;
+	if (timeout <= 0)
+		return 0;
+	return started.epochMicroseconds() + timeout * Poco::Timestamp::TimeDiff(Poco::Timespan::SECONDS);
+}
+
+void GSWorkerTask::prepare(Job& job) const
+{
+	if (!_outputDir.empty())
+	{
+		Poco::FastMutex::ScopedLock lock(job.statusMutex);
+		job.outputPath = Poco::Path(_outputDir, Poco::Path(job.outputPath).getFileName()).toString();
+	}
+
+	// an old output may be hard linked into the result cache,
+	// gs must not truncate and rewrite that inode in place
+	Poco::File out(job.outputPath);
+	if (out.exists())
+		out.remove();
+}
+
+bool GSWorkerTask::render(const Job& job, const GSRenderParams& params, GSRenderControl& control, GSOutputSink* pSink)
+{
+	// a sink needs the stdout callback, which only GSInstance installs
+	if (_gsPool.enabled() || pSink)
+	{
+		std::vector<std::string> gsArgs(job.gsArgs);
+		// keep PostScript %stdout messages out of the streamed device output
+		if (pSink)
+			gsArgs.push_back("-sstdout=%stderr");
+
+		GSInstance::Ptr pInstance = _gsPool.acquire(job.device, gsArgs);
+		if (!pInstance)
+			return false;
+
+		const bool ok = pInstance->run(job.inputPath, job.outputPath, pSink, &params, &control);
+		_gsPool.release(std::move(pInstance));
+		return ok;
+	}
+
+	// one-shot instance: path parameters required to be at the end
+	std::vector<std::string> gsArgs(job.gsArgs);
+	params.appendTo(gsArgs);
+	gsArgs.push_back("-sDEVICE=" + job.device);
+	gsArgs.push_back("-sOutputFile=" + job.outputPath);
+	gsArgs.push_back(job.inputPath);
+	return convert(gsArgs, &control);
+}
+
+int GSWorkerTask::shardCount(Job& job)
+{
+	if (_shardMinPages <= 0 || _shardCount < 2)
+		return 1;
+
+	// every PCL/PXL shard is a print job of its own, framing and all;
+	// concatenated they would not make one job
+	if (GSPresets::extension(job.device) == "pcl")
+		return 1;
+
+	// counting pages costs a gs startup, small files are never worth it
+	if (static_cast<Poco::Int64>(Poco::File(job.inputPath).getSize()) < _shardMinBytes)
+		return 1;
+
+	const int pages = pageCount(job.inputPath);
+	{
+		// GET /jobs/{id} reports it
+		Poco::FastMutex::ScopedLock lock(job.statusMutex);
+		job.pages = pages;
+	}
+	if (pages < _shardMinPages)
+		return 1;
+
+	return std::min(_shardCount, pages);
+}
+
+int GSWorkerTask::pageCount(const std::string& pdfPath)
+{
+	void* minst = NULL;
+	std::string out;
+
+	int code = gsapi_new_instance(&minst, NULL);
+	if (code < 0)
+	{
+		_logger.error("gs_new_instance error=%d", code);
+		return -1;
+	}
+
+	const char* argv[] = { "", "-q", "-dNODISPLAY", "-dSAFER", "-dNOPAUSE" };
+	gsapi_set_stdio_with_handle(minst, NULL, captureStdout, NULL, &out);
+	gsapi_add_control_path(minst, GS_PERMIT_FILE_READING, pdfPath.c_str());
+	code = gsapi_set_arg_encoding(minst, GS_ARG_ENCODING_UTF8);
+	if (code == 0)
+		code = gsapi_init_with_args(minst, 5, const_cast<char**>(argv));
+	if (code == 0)
+	{
+		int exitCode = 0;
+		const std::string cmd = "(" + psString(pdfPath) + ") (r) file runpdfbegin pdfpagecount = quit";
+		code = gsapi_run_string(minst, cmd.c_str(), 0, &exitCode);
+	}
+	gsapi_exit(minst);
+	gsapi_delete_instance(minst);
+
+	int pages = -1;
+	if ((code != 0 && code != gs_error_Quit) || !Poco::NumberParser::tryParse(Poco::trim(out), pages))
+	{
+		_logger.warning("Page count failed for [%s], error=%d", pdfPath, code);
+		return -1;
+	}
+	return pages;
+}
+
+bool GSWorkerTask::renderSharded(const Job& job, int shards, const GSRenderParams& params, GSRenderControl& control)
+{
+	struct Shard
+	{
+		int firstPage;
+		int lastPage;
+		std::string outputPath;
+		bool ok = false;
+	};
+
+	std::string prefix, suffix;
+	int width = 0;
+	bool zeroPad = false;
+	const bool perPage = splitPagePattern(job.outputPath, prefix, suffix, width, zeroPad);
+
+	const int perShard = (job.pages + shards - 1) / shards;
+	std::vector<Shard> parts;
+	for (int first = 1; first <= job.pages; first += perShard)
+	{
+		Shard sh;
+		sh.firstPage = first;
+		sh.lastPage = std::min(first + perShard - 1, job.pages);
+		const std::string tag = ".shard-" + Poco::NumberFormatter::format(parts.size());
+		sh.outputPath = perPage ? prefix + tag + "-%d" + suffix : job.outputPath + tag;
+		parts.push_back(std::move(sh));
+	}
+	_logger.information("Rendering %d page(s) of [%s] in %z shard(s).", job.pages, job.inputPath, parts.size());
+
+	// shard instances carry the page filter, so they are pooled apart from whole-document ones
+	std::vector<std::string> gsArgs(job.gsArgs);
+	gsArgs.push_back("-dFirstPage=1");
+	auto renderShard = [this, &job, &gsArgs, &params, &control](Shard& sh)
+	{
+		GSInstance::Ptr pInstance = _gsPool.acquire(job.device, gsArgs);
+		if (!pInstance)
+			return;
+		sh.ok = pInstance->run(job.inputPath, sh.outputPath, nullptr, &params, &control, sh.firstPage, sh.lastPage);
+		_gsPool.release(std::move(pInstance));
+	};
+
+	// the first shard renders on the worker's own thread
+	std::vector<std::unique_ptr<Poco::Thread>> threads;
+	threads.reserve(parts.size() - 1);
+	for (std::size_t i = 1; i < parts.size(); ++i)
+	{
+		threads.emplace_back(std::make_unique<Poco::Thread>());
+		Shard& sh = parts[i];
+		threads.back()->startFunc([&renderShard, &sh]() { renderShard(sh); });
+	}
+	renderShard(parts[0]);
+	for (auto& pThread : threads)
+		pThread->join();
+
+	bool ok = true;
+	for (const auto& sh : parts)
+	{
+		if (!sh.ok)
+		{
+			_logger.error("Shard pages %d-%d failed for job %s", sh.firstPage, sh.lastPage, job.outputPath);
+			ok = false;
+		}
+	}
+
+	// per-page outputs are renumbered into document page order; a single
+	// raster file gets the pages one after the other, as gs writes them
+	std::unique_ptr<std::ofstream> pOut;
+	if (ok && !perPage)
+		pOut.reset(new std::ofstream(job.outputPath, std::ios::binary | std::ios::trunc));
+
+	for (auto& sh : parts)
+	{
+		try
+		{
+			if (perPage)
+			{
+				const std::string shPrefix = sh.outputPath.substr(0, sh.outputPath.size() - suffix.size() - 2);
+				for (int page = sh.firstPage; page <= sh.lastPage; ++page)
+				{
+					Poco::File f(shPrefix + Poco::NumberFormatter::format(page - sh.firstPage + 1) + suffix);
+					if (!f.exists())
+						continue;
+					if (ok)
+						f.renameTo(pagePath(prefix, suffix, width, zeroPad, page));
+					else
+						f.remove();
+				}
+			}
+			else
 			{
-				Poco::AutoPtr<JobNotification> jn  = nf.cast<JobNotification>();
-				if (jn) 
+				Poco::File f(sh.outputPath);
+				if (!f.exists())
+					continue;
+				if (pOut)
 				{
-					auto job = jn->job;
-
-					const bool ok = convert(job->gsArgs);
-					if (ok) 
-					{
-						_logger.information("PDF->%s done: %s", job->formatLabel, job->outputPath);
-						if(!job->printers.empty())
-						{
-							_sendQ.enqueueNotification(new JobNotification(job));
-						}
-						else
-							_logger.warning("No listed printer, conversion only");
-						
-					} 
-					else 
-					{
-						_logger.error("PDF->%s failed for job %s", job->formatLabel, job->outputPath);
-					}
+					std::ifstream in(sh.outputPath, std::ios::binary);
+					*pOut << in.rdbuf();
 				}
-				else 
-					_logger.warning("Unexpected notification type in convQ");
+				f.remove();
 			}
 		}
 		catch (Poco::Exception& ex)
 		{
-			_logger.error(ex.displayText());
+			_logger.error("Merging shard pages %d-%d failed: %s", sh.firstPage, sh.lastPage, ex.displayText());
+			ok = false;
 		}
-		catch (std::exception& ex)
+	}
+
+	if (pOut)
+	{
+		pOut->close();
+		ok = ok && !pOut->fail();
+	}
+	return ok;
+}
+
+bool GSWorkerTask::stream(Job& job, const GSRenderParams& params, GSRenderControl& control)
+{
+	GSPrinterStream printers(job.printers, _printerPool, _logger);
+	if (!printers.open())
+		return false;
+
+	const bool ok = render(job, params, control, &printers);
+	if (ok)
+		printers.close();
+	else
+		printers.abort();
+
+	bool allOk = ok;
+	for (std::size_t i = 0; i < job.printers.size(); ++i)
+	{
+		if (!ok)
 		{
-			_logger.error(ex.what());
+			job.setPrinterResult(i, false, "conversion failed");
+			continue;
 		}
+		if (!printers.ok(i))
+		{
+			_logger.error("Failed sending to %s", job.printers[i]);
+			allOk = false;
+		}
+		job.setPrinterResult(i, printers.ok(i), printers.ok(i) ? std::string() : "streaming failed");
 	}
+
+	// there is no output file, only the source pdf to dispose of
+	if (allOk && _disposal)
+	{
+		try
+		{
+			Poco::File(job.inputPath).remove();
+			_logger.information("Deleted file [%s]", job.inputPath);
+		}
+		catch (Poco::Exception& ex)
+		{
+			_logger.error("Cleanup failed: %s", ex.displayText());
+		}
+	}
+	return allOk;
 }
 
-bool GSWorkerTask::convert(const std::vector<std::string>& gsArgs)
+bool GSWorkerTask::convert(const std::vector<std::string>& gsArgs, GSRenderControl* pControl)
 {
 	void* minst = NULL;
 	int code, code1;
@@ -121,13 +621,16 @@ bool GSWorkerTask::convert(const std::vector<std::string>& gsArgs)
 	else if (_logger.trace())
 		_logger.trace("Created gs instance.");
 
+	if (pControl)
+		gsapi_set_poll_with_handle(minst, pollControl, pControl);
+
 	code = gsapi_set_arg_encoding(minst, GS_ARG_ENCODING_UTF8);
 	if (code == 0)
 	{
 		code = gsapi_init_with_args(minst, gsargc, const_cast<char**>(argv.data()));
 		if (code == 0 || (code == gs_error_Quit))
 			_logger.trace("Conversion processed.");
-		else 
+		else if (!pControl || pControl->reason() == GSRenderControl::RUNNING)
 			_logger.error("gsapi_init_with_args error=%d", code);
 	}
 	else
@@ -141,6 +644,10 @@ bool GSWorkerTask::convert(const std::vector<std::string>& gsArgs)
 	if (_logger.trace())
 		_logger.trace("Deleted gs instance.");
 
+	// an abandoned run is reported by the caller, not as a gs error
+	if (pControl && pControl->reason() != GSRenderControl::RUNNING)
+		return false;
+
 	if ((code != 0) && (code != gs_error_Quit))
 	{
 		_logger.error("gs error=%d, quitting", code);
@@ -28,14 +28,24 @@
 #include "Poco/NotificationQueue.h"
 #include "Poco/Util/LayeredConfiguration.h"
 #include "GSNotification.h"
+#include "GSInstancePool.h"
+#include "GSResultCache.h"
+#include "GSPrinterPool.h"
+#include "GSAdmission.h"
+#include "GSScheduler.h"
+#include "GSJournal.h"
+#include "GSRenderTuning.h"
+#include "GSMemoryBudget.h"
+#include <atomic>
 #include <vector>
 
 
 class GSWorkerTask : public Poco::Task
 {
 public:
-	GSWorkerTask(Poco::NotificationQueue& convQ, Poco::NotificationQueue& sendQ, 
-		Poco::Logger& logger, Poco::Util::LayeredConfiguration& config);
+	GSWorkerTask(GSScheduler& scheduler, Poco::NotificationQueue& sendQ, GSInstancePool& gsPool,
+		GSResultCache& cache, GSPrinterPool& printerPool, GSAdmission& admission, GSJournal& journal, GSRenderTuning& tuning,
+		GSMemoryBudget& memory, Poco::Logger& logger, Poco::Util::LayeredConfiguration& config, int workerId = 1);
 	GSWorkerTask(const GSWorkerTask&) = delete;
 	GSWorkerTask& operator=(const GSWorkerTask&) = delete;
 	GSWorkerTask(GSWorkerTask&&) = delete;
@@ -45,13 +55,43 @@ public:
 
 	void runTask() override;
 
+	void cancel() override;
+		/// Also aborts the running conversion, which the journal
+		/// resumes after a restart.
+
 private:
-	bool convert(const std::vector<std::string>& gsArgs);
+	void process(const JobPtr& job);
+	void fail(Job& job);
+	bool aborted(Job& job, const GSRenderControl& control, double seconds);
+	Poco::Timestamp::TimeVal renderDeadline(const Job& job, const Poco::Timestamp& started) const;
+	void prepare(Job& job) const;
+	bool render(const Job& job, const GSRenderParams& params, GSRenderControl& control, GSOutputSink* pSink = nullptr);
+	bool stream(Job& job, const GSRenderParams& params, GSRenderControl& control);
+	int shardCount(Job& job);
+	int pageCount(const std::string& pdfPath);
+	bool renderSharded(const Job& job, int shards, const GSRenderParams& params, GSRenderControl& control);
+	bool convert(const std::vector<std::string>& gsArgs, GSRenderControl* pControl = nullptr);
 
-	Poco::NotificationQueue& _convQ;
+	GSScheduler& _scheduler;
 	Poco::NotificationQueue& _sendQ;
+	GSInstancePool& _gsPool;
+	GSResultCache& _cache;
+	GSPrinterPool& _printerPool;
+	GSAdmission& _admission;
+	GSJournal& _journal;
+	GSRenderTuning& _tuning;
+	GSMemoryBudget& _memory;
 	Poco::Logger& _logger;
 	Poco::Util::LayeredConfiguration& _config;
+	int _workerId;
+	bool _readonly;
+	bool _disposal;
+	int _shardMinPages;			// 0: never split a job into page ranges
+	Poco::Int64 _shardMinBytes;
+	int _shardCount;
+	std::string _outputDir;	// empty: output stays where the handler put it
+	int _renderTimeout;		// seconds, 0: none; render.timeout.<device> overrides
+	std::atomic<bool> _stopping{false};
 };
 
 #endif // GSWorkerTask_INCLUDED
@@ -0,0 +1,660 @@
+//
+// GSBench.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Load generator for GSServer: posts a mix of generated PDFs at a fixed
+// rate or concurrency, follows every job through GET /jobs/{id} and
+// reports throughput and per-stage latency percentiles as JSON.
+//
+// Run the server with readonly = true, or print to GSPrinterSim, so
+// that no real printer is involved.
+//
+
+
+#include "Poco/Util/Application.h"
+#include "Poco/Util/Option.h"
+#include "Poco/Util/OptionSet.h"
+#include "Poco/Util/OptionCallback.h"
+#include "Poco/Util/HelpFormatter.h"
+#include "Poco/Net/HTTPClientSession.h"
+#include "Poco/Net/HTTPRequest.h"
+#include "Poco/Net/HTTPResponse.h"
+#include "Poco/Net/NetException.h"
+#include "Poco/JSON/Parser.h"
+#include "Poco/JSON/Object.h"
+#include "Poco/DateTimeParser.h"
+#include "Poco/DateTimeFormat.h"
+#include "Poco/DateTime.h"
+#include "Poco/FileStream.h"
+#include "Poco/Mutex.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/NullStream.h"
+#include "Poco/Random.h"
+#include "Poco/StreamCopier.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+#include "Poco/URI.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+using namespace Poco;
+using namespace Poco::Net;
+using namespace Poco::Util;
+
+
+namespace
+{
+	//
+	// Synthetic documents
+	//
+
+	// a comment right after the header, numbered per request in place, so no
+	// two uploads are byte-identical and neither the result cache nor the
+	// deduplication of identical uploads can answer for Ghostscript
+	const std::string STAMP_PREFIX = "%GSBench-";
+	const std::size_t STAMP_DIGITS = 10;
+	const std::size_t STAMP_OFFSET = 15 + STAMP_PREFIX.size();
+
+	class PDFBuilder
+		/// Just enough PDF to exercise the interpreter: pages with text,
+		/// vector graphics and uncompressed RGB images.
+	{
+	public:
+		int add(const std::string& object)
+		{
+			_objects.push_back(object);
+			return static_cast<int>(_objects.size());
+		}
+
+		int addStream(const std::string& dict, const std::string& data)
+		{
+			return add("<< " + dict + " /Length " + NumberFormatter::format(data.size()) + " >>\nstream\n" + data + "\nendstream");
+		}
+
+		void set(int number, const std::string& object)
+		{
+			_objects[number - 1] = object;
+		}
+
+		std::string build(int root) const
+		{
+			std::string pdf = "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n" + STAMP_PREFIX + std::string(STAMP_DIGITS, '0') + "\n";
+			std::vector<std::size_t> offsets;
+			for (std::size_t i = 0; i < _objects.size(); ++i)
+			{
+				offsets.push_back(pdf.size());
+				pdf += NumberFormatter::format(i + 1) + " 0 obj\n" + _objects[i] + "\nendobj\n";
+			}
+			const std::size_t xref = pdf.size();
+			pdf += "xref\n0 " + NumberFormatter::format(_objects.size() + 1) + "\n0000000000 65535 f \n";
+			for (std::size_t off : offsets)
+				pdf += NumberFormatter::format0(off, 10) + " 00000 n \n";
+			pdf += "trailer\n<< /Size " + NumberFormatter::format(_objects.size() + 1) + " /Root " + NumberFormatter::format(root) + " 0 R >>\n";
+			pdf += "startxref\n" + NumberFormatter::format(xref) + "\n%%EOF\n";
+			return pdf;
+		}
+
+	private:
+		std::vector<std::string> _objects;
+	};
+
+	std::string text(double x, double y, int size, const std::string& s)
+	{
+		std::ostringstream os;
+		os << "BT /F1 " << size << " Tf " << x << " " << y << " Td (" << s << ") Tj ET\n";
+		return os.str();
+	}
+
+	std::string makeDocument(const std::vector<std::string>& contents, double width, double height,
+		const std::vector<std::pair<int, int>>& images = {})
+	{
+		PDFBuilder pdf;
+		const int catalog = pdf.add("");
+		const int pages = pdf.add("");
+		const int font = pdf.add("<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>");
+
+		// images are drawn full width on every page that asks for one
+		std::string xobjects;
+		Poco::Random rnd;
+		rnd.seed(42);
+		for (std::size_t i = 0; i < images.size(); ++i)
+		{
+			const int w = images[i].first, h = images[i].second;
+			std::string pixels(static_cast<std::size_t>(w) * h * 3, '\0');
+			for (int y = 0; y < h; ++y)
+			{
+				for (int x = 0; x < w; ++x)
+				{
+					const std::size_t p = (static_cast<std::size_t>(y) * w + x) * 3;
+					// gradients plus noise, so nothing compresses into a flat color
+					pixels[p] = static_cast<char>((x * 255 / w + rnd.next(32)) & 0xFF);
+					pixels[p + 1] = static_cast<char>((y * 255 / h + rnd.next(32)) & 0xFF);
+					pixels[p + 2] = static_cast<char>(((x + y) * 127 / (w + h) + rnd.next(64)) & 0xFF);
+				}
+			}
+			const int image = pdf.addStream("/Type /XObject /Subtype /Image /Width " + NumberFormatter::format(w) +
+				" /Height " + NumberFormatter::format(h) + " /ColorSpace /DeviceRGB /BitsPerComponent 8", pixels);
+			xobjects += " /Im" + NumberFormatter::format(i) + " " + NumberFormatter::format(image) + " 0 R";
+		}
+
+		std::string kids;
+		for (const auto& content : contents)
+		{
+			const int stream = pdf.addStream("", content);
+			const int page = pdf.add("<< /Type /Page /Parent " + NumberFormatter::format(pages) + " 0 R /MediaBox [0 0 " +
+				NumberFormatter::format(width, 0) + " " + NumberFormatter::format(height, 0) + "] /Contents " +
+				NumberFormatter::format(stream) + " 0 R /Resources << /Font << /F1 " + NumberFormatter::format(font) + " 0 R >>" +
+				(xobjects.empty() ? std::string() : " /XObject <<" + xobjects + " >>") + " >> >>");
+			kids += NumberFormatter::format(page) + " 0 R ";
+		}
+		pdf.set(catalog, "<< /Type /Catalog /Pages " + NumberFormatter::format(pages) + " 0 R >>");
+		pdf.set(pages, "<< /Type /Pages /Kids [" + kids + "] /Count " + NumberFormatter::format(contents.size()) + " >>");
+		return pdf.build(catalog);
+	}
+
+	std::string makeLabel()
+	{
+		// 4x6" shipping label: a few lines of text and a barcode of bars
+		std::string c = text(14, 400, 18, "SHIP TO: ACME WAREHOUSE 7") + text(14, 378, 12, "1200 Industrial Parkway, Dock 4");
+		for (int i = 0; i < 6; ++i)
+			c += text(14, 340 - 16 * i, 10, "REF " + NumberFormatter::format0(100000 + i * 7919, 8) + "  QTY " + NumberFormatter::format(i + 1));
+		Poco::Random rnd;
+		rnd.seed(7);
+		double x = 20;
+		while (x < 268)
+		{
+			const double w = 1 + rnd.next(4);
+			c += NumberFormatter::format(x, 1) + " 60 " + NumberFormatter::format(w, 1) + " 120 re f\n";
+			x += w + 1 + rnd.next(3);
+		}
+		return makeDocument({c}, 288, 432);
+	}
+
+	std::string makeInvoice(int pages)
+	{
+		std::vector<std::string> contents;
+		for (int p = 0; p < pages; ++p)
+		{
+			std::string c = text(72, 740, 20, "INVOICE 2025-" + NumberFormatter::format0(p + 1, 4)) +
+				text(400, 740, 10, "Page " + NumberFormatter::format(p + 1) + " of " + NumberFormatter::format(pages));
+			c += "0.5 w\n";
+			for (int row = 0; row < 40; ++row)
+			{
+				const double y = 700 - row * 15;
+				c += "72 " + NumberFormatter::format(y - 4, 1) + " m 540 " + NumberFormatter::format(y - 4, 1) + " l S\n";
+				c += text(76, y, 9, "Item " + NumberFormatter::format0(p * 40 + row + 1, 5)) +
+					text(180, y, 9, "Widget, assorted, box of " + NumberFormatter::format(row + 10)) +
+					text(470, y, 9, NumberFormatter::format((row + 1) * 3.75, 2));
+			}
+			contents.push_back(c);
+		}
+		return makeDocument(contents, 612, 792);
+	}
+
+	std::string makePhoto()
+	{
+		// one large image per page, the expensive case for raster devices
+		const std::string c = "q 540 405 0 0 36 350 cm /Im0 Do Q\n" + text(36, 320, 12, "Photo page");
+		return makeDocument({c, c}, 612, 792, {{1600, 1200}});
+	}
+
+
+	//
+	// Statistics
+	//
+
+	const std::vector<std::string> STAGES = { "received", "queued", "converting", "converted", "sending", "done" };
+
+	struct Sample
+	{
+		std::string doc;
+		int status = 0;
+		double accept = 0;				// seconds until the POST was answered
+		double total = -1;				// until done; -1: not followed or failed
+		std::map<std::string, double> stages;	// seconds spent before reaching each stage
+	};
+
+	double percentile(std::vector<double> values, double p)
+	{
+		if (values.empty())
+			return 0;
+		std::sort(values.begin(), values.end());
+		const std::size_t i = static_cast<std::size_t>(p * static_cast<double>(values.size() - 1) + 0.5);
+		return values[std::min(i, values.size() - 1)];
+	}
+
+	void writeLatency(std::ostream& os, const std::vector<double>& values)
+	{
+		os << "{\"count\":" << values.size()
+		   << ",\"p50\":" << percentile(values, 0.50)
+		   << ",\"p90\":" << percentile(values, 0.90)
+		   << ",\"p99\":" << percentile(values, 0.99)
+		   << ",\"max\":" << (values.empty() ? 0 : *std::max_element(values.begin(), values.end())) << "}";
+	}
+
+	bool parseTime(const std::string& s, Timestamp& ts)
+	{
+		DateTime dt;
+		int tzd = 0;
+		if (!DateTimeParser::tryParse(DateTimeFormat::ISO8601_FRAC_FORMAT, s, dt, tzd))
+			return false;
+		dt.makeUTC(tzd);
+		ts = dt.timestamp();
+		return true;
+	}
+}
+
+
+class GSBench : public Application
+{
+public:
+	GSBench()
+	{
+		setUnixOptions(true);
+	}
+
+protected:
+	void defineOptions(OptionSet& options) override
+	{
+		Application::defineOptions(options);
+
+		options.addOption(Option("help", "h", "display help information on command line arguments")
+			.required(false).repeatable(false)
+			.callback(OptionCallback<GSBench>(this, &GSBench::handleHelp)));
+		options.addOption(Option("server", "s", "GSServer address (default: localhost:9881)")
+			.required(false).repeatable(false).argument("host:port").binding("bench.server"));
+		options.addOption(Option("mix", "m", "document mix as weights, e.g. label=8,invoice=3,photo=1 (default)")
+			.required(false).repeatable(false).argument("mix").binding("bench.mix"));
+		options.addOption(Option("rate", "r", "requests per second, open loop (default: closed loop at --concurrency)")
+			.required(false).repeatable(false).argument("n").binding("bench.rate"));
+		options.addOption(Option("concurrency", "c", "clients sending in parallel (default: 4)")
+			.required(false).repeatable(false).argument("n").binding("bench.concurrency"));
+		options.addOption(Option("duration", "d", "seconds to send for (default: 30)")
+			.required(false).repeatable(false).argument("s").binding("bench.duration"));
+		options.addOption(Option("requests", "n", "stop after this many requests instead")
+			.required(false).repeatable(false).argument("n").binding("bench.requests"));
+		options.addOption(Option("device", "D", "sDEVICE for every job (default: pxlmono)")
+			.required(false).repeatable(false).argument("device").binding("bench.device"));
+		options.addOption(Option("print", "p", "print= list, e.g. the printer simulator (default: none)")
+			.required(false).repeatable(false).argument("printers").binding("bench.print"));
+		options.addOption(Option("args", "a", "extra query parameters, e.g. r203&priority=bulk")
+			.required(false).repeatable(false).argument("query").binding("bench.args"));
+		options.addOption(Option("sync", "y", "use mode=sync, the output comes back in the response")
+			.required(false).repeatable(false).binding("bench.sync"));
+		options.addOption(Option("invoice-pages", "i", "pages per invoice (default: 5)")
+			.required(false).repeatable(false).argument("n").binding("bench.invoicePages"));
+		options.addOption(Option("output", "o", "write the JSON report to this file as well")
+			.required(false).repeatable(false).argument("file").binding("bench.output"));
+		options.addOption(Option("timeout", "t", "seconds to follow a job before giving up (default: 300)")
+			.required(false).repeatable(false).argument("s").binding("bench.timeout"));
+	}
+
+	void handleHelp(const std::string& name, const std::string& value)
+	{
+		HelpFormatter helpFormatter(options());
+		helpFormatter.setCommand(commandName());
+		helpFormatter.setUsage("OPTIONS");
+		helpFormatter.setHeader("Load generator for GSServer.");
+		helpFormatter.format(std::cout);
+		stopOptionsProcessing();
+		_helpRequested = true;
+	}
+
+	int main(const ArgVec& args) override
+	{
+		if (_helpRequested)
+			return EXIT_OK;
+
+		const std::string server = config().getString("bench.server", "localhost:9881");
+		const std::string::size_type colon = server.rfind(':');
+		_host = server.substr(0, colon);
+		_port = colon == std::string::npos ? 9881 : static_cast<Poco::UInt16>(NumberParser::parse(server.substr(colon + 1)));
+		_device = config().getString("bench.device", "pxlmono");
+		_print = config().getString("bench.print", "");
+		_extra = config().getString("bench.args", "");
+		_sync = config().hasProperty("bench.sync");
+		_timeout = config().getDouble("bench.timeout", 300);
+		_rate = config().getDouble("bench.rate", 0);
+		_maxRequests = config().getInt("bench.requests", 0);
+		_duration = config().getDouble("bench.duration", _maxRequests > 0 ? 86400 : 30);
+		const int concurrency = std::max(1, config().getInt("bench.concurrency", 4));
+
+		buildMix(config().getString("bench.mix", "label=8,invoice=3,photo=1"), config().getInt("bench.invoicePages", 5));
+
+		std::cerr << "GSBench: " << (_rate > 0 ? NumberFormatter::format(_rate, 1) + " req/s" : NumberFormatter::format(concurrency) + " clients")
+			<< " against " << _host << ":" << _port << (_sync ? ", sync" : ", async") << std::endl;
+
+		_started.update();
+		std::vector<std::unique_ptr<Thread>> threads;
+		for (int i = 0; i < concurrency; ++i)
+		{
+			threads.emplace_back(new Thread);
+			threads.back()->startFunc([this, i]() { client(i); });
+		}
+		for (auto& t : threads)
+			t->join();
+		const double elapsed = _started.elapsed() / 1e6;
+
+		std::ostringstream report;
+		writeReport(report, elapsed, concurrency);
+		std::cout << report.str();
+		const std::string output = config().getString("bench.output", "");
+		if (!output.empty())
+		{
+			FileOutputStream fos(output);
+			fos << report.str();
+		}
+		return EXIT_OK;
+	}
+
+private:
+	struct Document
+	{
+		std::string name;
+		std::string pdf;
+		int weight;
+	};
+
+	void buildMix(const std::string& mix, int invoicePages)
+	{
+		StringTokenizer tok(mix, ",", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+		for (const auto& t : tok)
+		{
+			const std::string::size_type eq = t.find('=');
+			const std::string name = t.substr(0, eq);
+			const int weight = eq == std::string::npos ? 1 : NumberParser::parse(t.substr(eq + 1));
+			if (weight <= 0)
+				continue;
+			std::string pdf;
+			if (name == "label")
+				pdf = makeLabel();
+			else if (name == "invoice")
+				pdf = makeInvoice(invoicePages);
+			else if (name == "photo")
+				pdf = makePhoto();
+			else
+				throw InvalidArgumentException("unknown document in mix", name);
+			std::cerr << "  " << name << ": " << pdf.size() << " bytes, weight " << weight << std::endl;
+			_documents.push_back(Document{name, pdf, weight});
+			_totalWeight += weight;
+		}
+		if (_documents.empty())
+			throw InvalidArgumentException("empty document mix");
+	}
+
+	const Document& pick(Poco::Random& rnd) const
+	{
+		int w = static_cast<int>(rnd.next(static_cast<Poco::UInt32>(_totalWeight)));
+		for (const auto& d : _documents)
+		{
+			if (w < d.weight)
+				return d;
+			w -= d.weight;
+		}
+		return _documents.back();
+	}
+
+	bool nextTicket(Timestamp& scheduled, long& n)
+		/// Claims the next request. With a rate the request has a fixed
+		/// start time, so latency counts from when it should have been
+		/// sent, not from when a busy client got round to it.
+	{
+		n = _issued++;
+		if (_maxRequests > 0 && n >= _maxRequests)
+			return false;
+		if (_rate > 0)
+		{
+			scheduled = _started + static_cast<Timestamp::TimeDiff>(n * 1e6 / _rate);
+			if (scheduled - _started > static_cast<Timestamp::TimeDiff>(_duration * 1e6))
+				return false;
+			const Timestamp::TimeDiff wait = scheduled - Timestamp();
+			if (wait > 0)
+				Thread::sleep(static_cast<long>(wait / 1000));
+		}
+		else
+		{
+			scheduled.update();
+			if (_started.isElapsed(static_cast<Timestamp::TimeDiff>(_duration * 1e6)))
+				return false;
+		}
+		return true;
+	}
+
+	void client(int id)
+	{
+		Poco::Random rnd;
+		rnd.seed(static_cast<Poco::UInt32>(id * 7919 + 1));
+		HTTPClientSession session(_host, _port);
+		session.setTimeout(Timespan(static_cast<long>(_timeout), 0));
+		HTTPClientSession status(_host, _port);
+
+		Timestamp scheduled;
+		long n = 0;
+		while (nextTicket(scheduled, n))
+		{
+			const Document& doc = pick(rnd);
+			Sample sample;
+			sample.doc = doc.name;
+			std::string jobId;
+			try
+			{
+				const std::string name = "bench-" + NumberFormatter::format(id) + "-" + NumberFormatter::format(n);
+				std::string uri = "/?q&dNOPAUSE&dBATCH&dSAFER&sDEVICE=" + _device + "&sOutputFile=" + name + "&print=";
+				URI::encode(_print, "&", uri);
+				if (_sync)
+					uri += "&mode=sync";
+				if (!_extra.empty())
+					uri += "&" + _extra;
+
+				HTTPRequest req(HTTPRequest::HTTP_POST, uri, HTTPMessage::HTTP_1_1);
+				req.setContentType("application/pdf");
+				req.setContentLength(static_cast<std::streamsize>(doc.pdf.size()));
+				std::ostream& os = session.sendRequest(req);
+				os.write(doc.pdf.data(), static_cast<std::streamsize>(STAMP_OFFSET));
+				os << NumberFormatter::format0(n, static_cast<int>(STAMP_DIGITS));
+				os.write(doc.pdf.data() + STAMP_OFFSET + STAMP_DIGITS, static_cast<std::streamsize>(doc.pdf.size() - STAMP_OFFSET - STAMP_DIGITS));
+				HTTPResponse resp;
+				std::istream& rs = session.receiveResponse(resp);
+				NullOutputStream null;
+				StreamCopier::copyStream(rs, null);
+				sample.status = resp.getStatus();
+				sample.accept = (Timestamp() - scheduled) / 1e6;
+				jobId = resp.get("X-Job-Id", "");
+				if (resp.getStatus() == HTTPResponse::HTTP_SERVICE_UNAVAILABLE || !resp.getKeepAlive())
+					session.reset();
+			}
+			catch (Poco::Exception& ex)
+			{
+				sample.status = -1;
+				session.reset();
+				std::cerr << "request failed: " << ex.displayText() << std::endl;
+			}
+
+			if (sample.status == HTTPResponse::HTTP_OK && !jobId.empty())
+				follow(status, jobId, scheduled, sample);
+
+			FastMutex::ScopedLock lock(_mutex);
+			_samples.push_back(sample);
+		}
+	}
+
+	void follow(HTTPClientSession& session, const std::string& jobId, const Timestamp& scheduled, Sample& sample)
+		/// Polls the job until it is done or failed and takes the stage
+		/// times from its status.
+	{
+		const Timestamp started;
+		while (!started.isElapsed(static_cast<Timestamp::TimeDiff>(_timeout * 1e6)))
+		{
+			try
+			{
+				HTTPRequest req(HTTPRequest::HTTP_GET, "/jobs/" + jobId, HTTPMessage::HTTP_1_1);
+				session.sendRequest(req);
+				HTTPResponse resp;
+				std::istream& rs = session.receiveResponse(resp);
+				std::string body;
+				StreamCopier::copyToString(rs, body);
+				if (resp.getStatus() != HTTPResponse::HTTP_OK)
+					return;
+
+				JSON::Parser parser;
+				JSON::Object::Ptr pJob = parser.parse(body).extract<JSON::Object::Ptr>();
+				const std::string state = pJob->getValue<std::string>("state");
+				if (state == "done" || state == "failed" || state == "cancelled")
+				{
+					JSON::Object::Ptr pTimes = pJob->getObject("times");
+					Timestamp received;
+					if (pTimes && pTimes->has("received") && parseTime(pTimes->getValue<std::string>("received"), received))
+					{
+						for (const auto& stage : STAGES)
+						{
+							Timestamp at;
+							if (pTimes->has(stage) && parseTime(pTimes->getValue<std::string>(stage), at))
+								sample.stages[stage] = (at - received) / 1e6;
+						}
+					}
+					if (state == "done")
+						sample.total = (Timestamp() - scheduled) / 1e6;
+					else
+						sample.status = -2;
+					return;
+				}
+			}
+			catch (Poco::Exception& ex)
+			{
+				session.reset();
+				std::cerr << "status of " << jobId << " failed: " << ex.displayText() << std::endl;
+				return;
+			}
+			Thread::sleep(20);
+		}
+		sample.status = -3;
+	}
+
+	void writeReport(std::ostream& os, double elapsed, int concurrency) const
+	{
+		std::map<std::string, std::vector<double>> stages;
+		std::map<std::string, std::vector<double>> totals;
+		std::vector<double> accept, total;
+		std::size_t ok = 0, rejected = 0, failed = 0, errors = 0, timedOut = 0;
+		Poco::UInt64 bytes = 0;
+		for (const auto& s : _samples)
+		{
+			if (s.status == HTTPResponse::HTTP_SERVICE_UNAVAILABLE)
+			{
+				++rejected;
+				continue;
+			}
+			if (s.status == -2)
+				++failed;
+			else if (s.status == -3)
+				++timedOut;
+			else if (s.status != HTTPResponse::HTTP_OK)
+			{
+				++errors;
+				continue;
+			}
+			accept.push_back(s.accept);
+			if (s.total >= 0 || (_sync && s.status == HTTPResponse::HTTP_OK))
+			{
+				const double t = s.total >= 0 ? s.total : s.accept;
+				total.push_back(t);
+				totals[s.doc].push_back(t);
+				++ok;
+				for (const auto& d : _documents)
+				{
+					if (d.name == s.doc)
+						bytes += d.pdf.size();
+				}
+			}
+			for (const auto& st : s.stages)
+				stages[st.first].push_back(st.second);
+		}
+
+		os << std::fixed << std::setprecision(4);
+		os << "{\"server\":\"" << _host << ":" << _port << "\""
+		   << ",\"device\":\"" << _device << "\""
+		   << ",\"mode\":\"" << (_sync ? "sync" : "async") << "\""
+		   << ",\"rate\":" << _rate
+		   << ",\"concurrency\":" << concurrency
+		   << ",\"elapsed\":" << elapsed
+		   << ",\"requests\":" << _samples.size()
+		   << ",\"completed\":" << ok
+		   << ",\"rejected\":" << rejected
+		   << ",\"failed\":" << failed
+		   << ",\"timedOut\":" << timedOut
+		   << ",\"errors\":" << errors
+		   << ",\"throughput\":" << (elapsed > 0 ? ok / elapsed : 0)
+		   << ",\"uploadBytesPerSecond\":" << (elapsed > 0 ? bytes / elapsed : 0)
+		   << ",\"latency\":{\"accept\":";
+		writeLatency(os, accept);
+		os << ",\"total\":";
+		writeLatency(os, total);
+		os << "},\"stages\":{";
+		bool first = true;
+		for (const auto& stage : STAGES)
+		{
+			auto it = stages.find(stage);
+			if (it == stages.end())
+				continue;
+			os << (first ? "" : ",") << "\"" << stage << "\":";
+			writeLatency(os, it->second);
+			first = false;
+		}
+		os << "},\"documents\":{";
+		first = true;
+		for (const auto& t : totals)
+		{
+			os << (first ? "" : ",") << "\"" << t.first << "\":";
+			writeLatency(os, t.second);
+			first = false;
+		}
+		os << "}}\n";
+	}
+
+	bool _helpRequested = false;
+	std::string _host;
+	Poco::UInt16 _port = 9881;
+	std::string _device;
+	std::string _print;
+	std::string _extra;
+	bool _sync = false;
+	double _timeout = 300;
+	double _rate = 0;
+	double _duration = 30;
+	long _maxRequests = 0;
+	std::vector<Document> _documents;
+	int _totalWeight = 0;
+	Timestamp _started;
+	std::atomic<long> _issued{0};
+	std::vector<Sample> _samples;
+	mutable FastMutex _mutex;
+};
+
+
+POCO_APP_MAIN(GSBench)
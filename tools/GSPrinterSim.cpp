@@ -0,0 +1,497 @@
+//
+// GSPrinterSim.cpp
+//
+//
+// Copyright (C) 2025 Aleph ONE Software Engineering LLC
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Printer simulator for GSServer: listens on any number of ports and
+// acts like a RAW/9100 printer, with configurable drain bandwidth,
+// accept delay, stalls, resets and refused connections. Every
+// connection is logged as one JSON line with its byte count and CRC32,
+// per job when the stream is framed by PJL UEL (printer.keepAlive).
+//
+
+
+#include "Poco/Util/ServerApplication.h"
+#include "Poco/Util/Option.h"
+#include "Poco/Util/OptionSet.h"
+#include "Poco/Util/OptionCallback.h"
+#include "Poco/Util/HelpFormatter.h"
+#include "Poco/Net/TCPServer.h"
+#include "Poco/Net/TCPServerConnection.h"
+#include "Poco/Net/TCPServerConnectionFactory.h"
+#include "Poco/Net/TCPServerParams.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/Net/NetException.h"
+#include "Poco/Checksum.h"
+#include "Poco/FileStream.h"
+#include "Poco/Mutex.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Random.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/Thread.h"
+#include "Poco/ThreadPool.h"
+#include "Poco/Timestamp.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+using namespace Poco;
+using namespace Poco::Net;
+using namespace Poco::Util;
+
+
+namespace
+{
+	const std::string UEL("\x1B%-12345X");
+
+
+	struct Behavior
+		/// What the simulated printers do; shared by all ports.
+	{
+		double bandwidth = 0;			// bytes per second per connection, 0 = as fast as possible
+		long acceptDelay = 0;			// ms before the first read
+		double stallRate = 0;			// share of connections that stop reading once
+		long stall = 0;					// ms such a stall lasts
+		double resetRate = 0;			// share of connections reset part way through
+		double refuseRate = 0;			// share of connections reset right after accept
+		Poco::UInt64 resetWithin = 0;	// a reset happens within this many bytes
+		int receiveBuffer = 0;			// SO_RCVBUF, small values make backpressure visible
+		long idleTimeout = 60;			// seconds without data before the connection is closed
+	};
+
+
+	class Recorder
+		/// Writes one JSON line per connection and keeps per-port totals.
+	{
+	public:
+		struct Totals
+		{
+			Poco::UInt64 connections = 0;
+			Poco::UInt64 jobs = 0;
+			Poco::UInt64 bytes = 0;
+			Poco::UInt64 resets = 0;
+			Poco::UInt64 refused = 0;
+			Poco::UInt64 timedOut = 0;
+		};
+
+		explicit Recorder(std::ostream& out):
+			_out(out)
+		{
+		}
+
+		void record(Poco::UInt16 port, const std::string& line, const std::string& result, Poco::UInt64 jobs, Poco::UInt64 bytes)
+		{
+			FastMutex::ScopedLock lock(_mutex);
+			_out << line << std::endl;
+			Totals& t = _totals[port];
+			++t.connections;
+			t.jobs += jobs;
+			t.bytes += bytes;
+			if (result == "reset")
+				++t.resets;
+			else if (result == "refused")
+				++t.refused;
+			else if (result == "timeout")
+				++t.timedOut;
+		}
+
+		void summary(std::ostream& os) const
+		{
+			FastMutex::ScopedLock lock(_mutex);
+			for (const auto& t : _totals)
+			{
+				os << "{\"port\":" << t.first << ",\"summary\":true,\"connections\":" << t.second.connections
+				   << ",\"jobs\":" << t.second.jobs << ",\"bytes\":" << t.second.bytes
+				   << ",\"resets\":" << t.second.resets << ",\"refused\":" << t.second.refused
+				   << ",\"timedOut\":" << t.second.timedOut << "}" << std::endl;
+			}
+		}
+
+	private:
+		std::ostream& _out;
+		std::map<Poco::UInt16, Totals> _totals;
+		mutable FastMutex _mutex;
+	};
+
+
+	class JobSplitter
+		/// Follows the stream and checksums every UEL delimited job.
+		/// Without any UEL the whole connection is one job.
+	{
+	public:
+		struct Job
+		{
+			Poco::UInt64 bytes;
+			Poco::UInt32 crc;
+		};
+
+		void feed(const char* data, std::size_t length)
+		{
+			_all.update(data, static_cast<unsigned>(length));
+			for (std::size_t i = 0; i < length; ++i)
+			{
+				const char c = data[i];
+				if (c == UEL[_match])
+				{
+					if (++_match == UEL.size())
+					{
+						_framed = true;
+						endJob();
+						_match = 0;
+					}
+					continue;
+				}
+				// a broken match was payload after all; the UEL repeats no prefix of itself
+				if (_match > 0)
+				{
+					append(UEL.data(), _match);
+					_match = 0;
+					if (c == UEL[0])
+					{
+						_match = 1;
+						continue;
+					}
+				}
+				append(&c, 1);
+			}
+		}
+
+		std::vector<Job> finish()
+		{
+			if (_match > 0)
+				append(UEL.data(), _match);
+			endJob();
+			return _jobs;
+		}
+
+		Poco::UInt32 checksum() const
+		{
+			return _all.checksum();
+		}
+
+		bool framed() const
+		{
+			return _framed;
+		}
+
+	private:
+		void append(const char* data, std::size_t length)
+		{
+			_job.update(data, static_cast<unsigned>(length));
+			_bytes += length;
+		}
+
+		void endJob()
+		{
+			// the separators themselves frame empty jobs, those are not counted
+			if (_bytes > 0)
+				_jobs.push_back(Job{_bytes, _job.checksum()});
+			_job = Checksum(Checksum::TYPE_CRC32);
+			_bytes = 0;
+		}
+
+		Checksum _all{Checksum::TYPE_CRC32};
+		Checksum _job{Checksum::TYPE_CRC32};
+		Poco::UInt64 _bytes = 0;
+		std::size_t _match = 0;
+		bool _framed = false;
+		std::vector<Job> _jobs;
+	};
+
+
+	class PrinterConnection : public TCPServerConnection
+	{
+	public:
+		PrinterConnection(const StreamSocket& socket, Poco::UInt16 port, const Behavior& behavior, Recorder& recorder):
+			TCPServerConnection(socket),
+			_port(port),
+			_behavior(behavior),
+			_recorder(recorder)
+		{
+		}
+
+		void run() override
+		{
+			StreamSocket& ss = socket();
+			const Timestamp started;
+			std::string peer;
+			try
+			{
+				peer = ss.peerAddress().toString();
+			}
+			catch (Poco::Exception&)
+			{
+			}
+
+			Poco::Random rnd;
+			rnd.seed();
+			const bool refuse = chance(rnd, _behavior.refuseRate);
+			const bool reset = !refuse && chance(rnd, _behavior.resetRate);
+			const bool stall = !refuse && _behavior.stall > 0 && chance(rnd, _behavior.stallRate);
+			const Poco::UInt64 within = _behavior.resetWithin > 0 ? _behavior.resetWithin : 1024 * 1024;
+			const Poco::UInt64 resetAt = reset ? rnd.next(static_cast<Poco::UInt32>(std::min<Poco::UInt64>(within, 0xFFFFFFFF))) : 0;
+			Poco::UInt64 stallAt = stall ? rnd.next(64 * 1024) : 0;
+
+			JobSplitter splitter;
+			Poco::UInt64 bytes = 0;
+			std::string result = "ok";
+			try
+			{
+				if (refuse)
+				{
+					abort(ss);
+					result = "refused";
+				}
+				else
+				{
+					if (_behavior.acceptDelay > 0)
+						Thread::sleep(_behavior.acceptDelay);
+					ss.setReceiveTimeout(Timespan(_behavior.idleTimeout, 0));
+
+					char buffer[16384];
+					std::size_t chunk = sizeof(buffer);
+					// at low bandwidths read in about 20 steps per second
+					if (_behavior.bandwidth > 0)
+						chunk = std::max<std::size_t>(1, std::min<std::size_t>(chunk, static_cast<std::size_t>(_behavior.bandwidth / 20)));
+
+					const Timestamp drainStart;
+					for (;;)
+					{
+						if (stall && bytes >= stallAt)
+						{
+							Thread::sleep(_behavior.stall);
+							stallAt = ~Poco::UInt64(0);
+						}
+						std::size_t want = chunk;
+						if (reset && resetAt - bytes < want)
+							want = static_cast<std::size_t>(resetAt - bytes);
+						if (reset && want == 0)
+						{
+							abort(ss);
+							result = "reset";
+							break;
+						}
+
+						const int n = ss.receiveBytes(buffer, static_cast<int>(want));
+						if (n <= 0)
+							break;
+						splitter.feed(buffer, static_cast<std::size_t>(n));
+						bytes += static_cast<Poco::UInt64>(n);
+
+						if (_behavior.bandwidth > 0)
+						{
+							// sleep until the bytes read so far fit the bandwidth
+							const Timestamp::TimeDiff due = static_cast<Timestamp::TimeDiff>(bytes * 1e6 / _behavior.bandwidth);
+							const Timestamp::TimeDiff ahead = due - drainStart.elapsed();
+							if (ahead > 1000)
+								Thread::sleep(static_cast<long>(ahead / 1000));
+						}
+					}
+				}
+			}
+			catch (TimeoutException&)
+			{
+				result = "timeout";
+			}
+			catch (Poco::Exception& ex)
+			{
+				result = "error: " + ex.displayText();
+			}
+
+			const std::vector<JobSplitter::Job> jobs = splitter.finish();
+			std::ostringstream line;
+			line << "{\"port\":" << _port << ",\"peer\":\"" << peer << "\",\"result\":\"" << result << "\""
+			     << ",\"bytes\":" << bytes << ",\"crc32\":\"" << NumberFormatter::formatHex(splitter.checksum(), 8) << "\""
+			     << ",\"seconds\":" << started.elapsed() / 1e6
+			     << ",\"stalled\":" << (stall ? "true" : "false")
+			     << ",\"framed\":" << (splitter.framed() ? "true" : "false") << ",\"jobs\":[";
+			for (std::size_t i = 0; i < jobs.size(); ++i)
+				line << (i ? "," : "") << "{\"bytes\":" << jobs[i].bytes << ",\"crc32\":\"" << NumberFormatter::formatHex(jobs[i].crc, 8) << "\"}";
+			line << "]}";
+			_recorder.record(_port, line.str(), result, jobs.size(), bytes);
+		}
+
+	private:
+		static bool chance(Poco::Random& rnd, double rate)
+		{
+			return rate > 0 && rnd.nextDouble() < rate;
+		}
+
+		static void abort(StreamSocket& ss)
+			/// Closes with a RST instead of a FIN, like a printer dropping the job.
+		{
+			ss.setLinger(true, 0);
+			ss.close();
+		}
+
+		Poco::UInt16 _port;
+		const Behavior& _behavior;
+		Recorder& _recorder;
+	};
+
+
+	class PrinterConnectionFactory : public TCPServerConnectionFactory
+	{
+	public:
+		PrinterConnectionFactory(Poco::UInt16 port, const Behavior& behavior, Recorder& recorder):
+			_port(port),
+			_behavior(behavior),
+			_recorder(recorder)
+		{
+		}
+
+		TCPServerConnection* createConnection(const StreamSocket& socket) override
+		{
+			return new PrinterConnection(socket, _port, _behavior, _recorder);
+		}
+
+	private:
+		Poco::UInt16 _port;
+		const Behavior& _behavior;
+		Recorder& _recorder;
+	};
+}
+
+
+class GSPrinterSim : public ServerApplication
+{
+protected:
+	void defineOptions(OptionSet& options) override
+	{
+		ServerApplication::defineOptions(options);
+
+		options.addOption(Option("help", "h", "display help information on command line arguments")
+			.required(false).repeatable(false)
+			.callback(OptionCallback<GSPrinterSim>(this, &GSPrinterSim::handleHelp)));
+		options.addOption(Option("ports", "p", "ports to listen on, e.g. 9100-9109,9200 (default: 9100)")
+			.required(false).repeatable(false).argument("ports").binding("sim.ports"));
+		options.addOption(Option("address", "A", "address to bind (default: 127.0.0.1)")
+			.required(false).repeatable(false).argument("ip").binding("sim.address"));
+		options.addOption(Option("bandwidth", "b", "drain rate per connection in KB/s (default: 0, unlimited)")
+			.required(false).repeatable(false).argument("KB/s").binding("sim.bandwidth"));
+		options.addOption(Option("accept-delay", "a", "ms before a connection is first read")
+			.required(false).repeatable(false).argument("ms").binding("sim.acceptDelay"));
+		options.addOption(Option("stall-rate", "S", "share of connections (0-1) that stop reading once")
+			.required(false).repeatable(false).argument("rate").binding("sim.stallRate"));
+		options.addOption(Option("stall", "s", "ms a stall lasts (default: 10000)")
+			.required(false).repeatable(false).argument("ms").binding("sim.stall"));
+		options.addOption(Option("reset-rate", "r", "share of connections (0-1) reset part way through")
+			.required(false).repeatable(false).argument("rate").binding("sim.resetRate"));
+		options.addOption(Option("reset-within", "w", "a reset happens within this many KB (default: 1024)")
+			.required(false).repeatable(false).argument("KB").binding("sim.resetWithin"));
+		options.addOption(Option("refuse-rate", "f", "share of connections (0-1) reset right after accept")
+			.required(false).repeatable(false).argument("rate").binding("sim.refuseRate"));
+		options.addOption(Option("rcvbuf", "B", "socket receive buffer in bytes (default: system)")
+			.required(false).repeatable(false).argument("bytes").binding("sim.receiveBuffer"));
+		options.addOption(Option("idle-timeout", "t", "seconds without data before a connection is closed (default: 60)")
+			.required(false).repeatable(false).argument("s").binding("sim.idleTimeout"));
+		options.addOption(Option("threads", "T", "connections served at once over all ports (default: 256)")
+			.required(false).repeatable(false).argument("n").binding("sim.threads"));
+		options.addOption(Option("log", "l", "append the JSON lines to this file instead of stdout")
+			.required(false).repeatable(false).argument("file").binding("sim.log"));
+	}
+
+	void handleHelp(const std::string& name, const std::string& value)
+	{
+		HelpFormatter helpFormatter(options());
+		helpFormatter.setCommand(commandName());
+		helpFormatter.setUsage("OPTIONS");
+		helpFormatter.setHeader("RAW/9100 printer simulator for GSServer.");
+		helpFormatter.format(std::cout);
+		stopOptionsProcessing();
+		_helpRequested = true;
+	}
+
+	int main(const ArgVec& args) override
+	{
+		if (_helpRequested)
+			return EXIT_OK;
+
+		Behavior behavior;
+		behavior.bandwidth = config().getDouble("sim.bandwidth", 0) * 1024;
+		behavior.acceptDelay = config().getInt("sim.acceptDelay", 0);
+		behavior.stallRate = config().getDouble("sim.stallRate", 0);
+		behavior.stall = config().getInt("sim.stall", 10000);
+		behavior.resetRate = config().getDouble("sim.resetRate", 0);
+		behavior.resetWithin = static_cast<Poco::UInt64>(config().getInt64("sim.resetWithin", 1024)) * 1024;
+		behavior.refuseRate = config().getDouble("sim.refuseRate", 0);
+		behavior.receiveBuffer = config().getInt("sim.receiveBuffer", 0);
+		behavior.idleTimeout = config().getInt("sim.idleTimeout", 60);
+
+		std::unique_ptr<FileOutputStream> pLog;
+		const std::string log = config().getString("sim.log", "");
+		if (!log.empty())
+			pLog.reset(new FileOutputStream(log, std::ios::out | std::ios::app));
+		Recorder recorder(pLog ? static_cast<std::ostream&>(*pLog) : std::cout);
+
+		const int threads = config().getInt("sim.threads", 256);
+		ThreadPool pool("PrinterSim", 2, threads);
+		const std::string address = config().getString("sim.address", "127.0.0.1");
+		std::vector<std::unique_ptr<TCPServer>> servers;
+		for (Poco::UInt16 port : parsePorts(config().getString("sim.ports", "9100")))
+		{
+			ServerSocket socket(SocketAddress(address, port), 256);
+			if (behavior.receiveBuffer > 0)
+				socket.setReceiveBufferSize(behavior.receiveBuffer);	// inherited by accepted sockets
+			TCPServerParams::Ptr pParams = new TCPServerParams;
+			pParams->setMaxThreads(threads);
+			pParams->setMaxQueued(256);
+			servers.emplace_back(new TCPServer(new PrinterConnectionFactory(port, behavior, recorder), pool, socket, pParams));
+			servers.back()->start();
+		}
+		std::cerr << "GSPrinterSim: " << servers.size() << " port(s) on " << address << std::endl;
+
+		waitForTerminationRequest();
+
+		for (auto& s : servers)
+			s->stop();
+		pool.joinAll();
+		recorder.summary(pLog ? static_cast<std::ostream&>(*pLog) : std::cout);
+		return EXIT_OK;
+	}
+
+private:
+	static std::vector<Poco::UInt16> parsePorts(const std::string& spec)
+	{
+		std::vector<Poco::UInt16> ports;
+		StringTokenizer tok(spec, ",", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+		for (const auto& t : tok)
+		{
+			const std::string::size_type dash = t.find('-');
+			const unsigned first = NumberParser::parseUnsigned(t.substr(0, dash));
+			const unsigned last = dash == std::string::npos ? first : NumberParser::parseUnsigned(t.substr(dash + 1));
+			if (first == 0 || last > 65535 || last < first)
+				throw InvalidArgumentException("bad port range", t);
+			for (unsigned p = first; p <= last; ++p)
+				ports.push_back(static_cast<Poco::UInt16>(p));
+		}
+		return ports;
+	}
+
+	bool _helpRequested = false;
+};
+
+
+POCO_SERVER_MAIN(GSPrinterSim)